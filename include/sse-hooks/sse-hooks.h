@@ -42,6 +42,24 @@
 /// To match a compiled in API against one loaded at run-time.
 #define SSEH_API_VERSION (1)
 
+/// Text JSON, as used by #sseh_identify() and #sseh_merge_patch()
+#define SSEH_FORMAT_JSON (0)
+
+/// Concise Binary Object Representation, see https://tools.ietf.org/html/rfc7049
+#define SSEH_FORMAT_CBOR (1)
+
+/// MessagePack, see https://msgpack.org
+#define SSEH_FORMAT_MSGPACK (2)
+
+/// Relative call instructions, as searched by #sseh_find_callers()
+#define SSEH_XREF_CALL (1)
+
+/// Relative jump instructions, as searched by #sseh_find_callers()
+#define SSEH_XREF_JUMP (2)
+
+/// Instructions with RIP-relative memory operands, as searched by #sseh_find_callers()
+#define SSEH_XREF_DATA (4)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -122,6 +140,9 @@ typedef int (SSEH_CCONV* sseh_init_t) ();
 
 /**
  * Uninitialize SSEH.
+ *
+ * The detours of all the profiles are removed at once, starting from the last one applied on each
+ * target. Then all the memory kept for them is released.
  */
 
 SSEH_API void SSEH_CCONV
@@ -182,6 +203,9 @@ typedef int (SSEH_CCONV* sseh_find_address_t)
 /**
  * Load from file or string and replace the JSON configuration.
  *
+ * Files may also be in #SSEH_FORMAT_CBOR or #SSEH_FORMAT_MSGPACK. These are
+ * detected by the leading byte, as the registry root must be an object.
+ *
  * @param[in] filepath to read from
  */
 
@@ -217,6 +241,10 @@ typedef int (SSEH_CCONV* sseh_map_name_t) (const char*, uintptr_t);
  * make sense only if there is entry already for them after a detour. If
  * an address of such a method is needed, see #sseh_find_address().
  *
+ * Entries having a "string_ref" object instead of a target are resolved on
+ * the first call, to the function referencing that string literal, and the
+ * found target is mapped for the next calls.
+ *
  * As a back up plan, this function tries to find an Address Library id
  * assigned to this name. Then it searches an address for this id. The
  * mappings between names and that library ids are done in text files
@@ -225,6 +253,10 @@ typedef int (SSEH_CCONV* sseh_map_name_t) (const char*, uintptr_t);
  * are not allowed, dublicated ids are fine. Text lines not conforming
  * to <start-of-row><name><one or more empty spaces><id> are ignored.
  *
+ * Lastly, names of the form "<Class>::vtbl" are looked up in the virtual
+ * tables of the game, found through its RTTI, and "<Class>::vtbl[<n>]" in
+ * their entries. A table ends before its first entry not pointing to code.
+ *
  * @param[in] name to search the target address for
  * @param[out] target to receive the found value
  * @returns non-zero on success, otherwise see #sseh_last_error ()
@@ -237,9 +269,53 @@ sseh_find_target (const char* name, uintptr_t* target);
 
 typedef int (SSEH_CCONV* sseh_find_target_t) (const char*, uintptr_t*);
 
+/**
+ * Find the targets of many names at once.
+ *
+ * Each name is resolved as #sseh_find_target() does, but the ones left to
+ * the Address Library are sorted and looked up together, in one pass over
+ * its tables, rather than searching them anew for each name. This is the
+ * cheaper way to resolve the dozens of names a plugin needs on load.
+ *
+ * @param[in] names to search the target addresses for
+ * @param[in] count of the @param names and @param targets arrays
+ * @param[out] targets to receive the found values, 0 for the names not found
+ * @returns non-zero if all were found, otherwise see #sseh_last_error ()
+ */
+
+SSEH_API int SSEH_CCONV
+sseh_find_targets (const char* const* names, size_t count, uintptr_t* targets);
+
+/** @see #sseh_find_targets() */
+
+typedef int (SSEH_CCONV* sseh_find_targets_t) (const char* const*, size_t, uintptr_t*);
+
+/**
+ * Find the Address Library entries of many ids at once.
+ *
+ * Same as #sseh_find_targets(), for plugins knowing the ids rather than the
+ * names mapped to them.
+ *
+ * @param[in] ids to search the target addresses for
+ * @param[in] count of the @param ids and @param targets arrays
+ * @param[out] targets to receive the found values, 0 for the ids not found
+ * @returns non-zero if all were found, otherwise see #sseh_last_error ()
+ */
+
+SSEH_API int SSEH_CCONV
+sseh_find_targets_by_id (const uint64_t* ids, size_t count, uintptr_t* targets);
+
+/** @see #sseh_find_targets_by_id() */
+
+typedef int (SSEH_CCONV* sseh_find_targets_by_id_t) (const uint64_t*, size_t, uintptr_t*);
+
 /**
  * Find the name mapped to given target address.
  *
+ * An address inside a function, whose start is mapped, is named relative to
+ * it as "<name>+0x<offset>". The function boundaries are taken from the
+ * exception directory (.pdata) of the module holding the address.
+ *
  * @param[in] target address to search for, zero is invalid
  * @param[in,out] size (optional) in bytes of @param name, on exit how many
  * bytes were actually written (excluding the terminating null) or how many
@@ -274,6 +350,30 @@ sseh_detour (const char* name, void* detour, void** original);
 
 typedef int (SSEH_CCONV* sseh_detour_t) (const char*, void*, void**);
 
+/**
+ * Create a new detour with given priority and queue it for enabling.
+ *
+ * When many profiles detour the same target, the ones with higher priority are
+ * called first, regardless of the order in which the profiles applied them.
+ * Detours of equal priority are called in the reverse order of their applying,
+ * as with #sseh_detour() which uses priority zero. Detours made by other
+ * modules than SSEH are not reordered. The priority is kept in the registry
+ * under /map/name/detours/detour/priority.
+ *
+ * @param[in] name of the mapped ones, or function@module to find and use
+ * @param[in] detour function to replace the target one
+ * @param[out] original to use when the target function has to be called
+ * @param[in] priority of this detour in the chain of the target
+ * @returns non-zero on success, otherwise see #sseh_last_error ()
+ */
+
+SSEH_API int SSEH_CCONV
+sseh_detour_priority (const char* name, void* detour, void** original, int priority);
+
+/** @see #sseh_detour_priority() */
+
+typedef int (SSEH_CCONV* sseh_detour_priority_t) (const char*, void*, void**, int);
+
 /******************************************************************************/
 
 /**
@@ -391,13 +491,193 @@ sseh_merge_patch (const char* json);
 
 typedef int (SSEH_CCONV* sseh_merge_patch_t) (const char*);
 
+/**
+ * Report a JSON at given location, encoded in the requested format.
+ *
+ * Same as #sseh_identify(), but allows binary output which is smaller and
+ * faster to parse back.
+ *
+ * @param[in] pointer to use (e.g. "/hooks")
+ * @param[in] format one of #SSEH_FORMAT_JSON, #SSEH_FORMAT_CBOR or
+ * #SSEH_FORMAT_MSGPACK
+ * @param[in,out] size (optional) number of bytes of the incoming @param data
+ * array. On exit reports how many bytes were actually used or how many bytes
+ * are needed to store the whole result. A terminating null is always appended.
+ * @param[out] data (optional) to store the reported result
+ * @returns non-zero on success, otherwise see #sseh_last_error ()
+ */
+
+SSEH_API int SSEH_CCONV
+sseh_identify_as (const char* pointer, int format, size_t* size, void* data);
+
+/** @see #sseh_identify_as() */
+
+typedef int (SSEH_CCONV* sseh_identify_as_t) (const char*, int, size_t*, void*);
+
+/**
+ * Merge a JSON patch, encoded in the given format, in the internal
+ * configuration.
+ *
+ * Same as #sseh_merge_patch(), but the patch may also be binary.
+ *
+ * @param[in] format one of #SSEH_FORMAT_JSON, #SSEH_FORMAT_CBOR or
+ * #SSEH_FORMAT_MSGPACK
+ * @param[in] data of the patch
+ * @param[in] size in bytes of @param data
+ * @returns non-zero on success, otherwise see #sseh_last_error ()
+ */
+
+SSEH_API int SSEH_CCONV
+sseh_merge_patch_as (int format, const void* data, size_t size);
+
+/** @see #sseh_merge_patch_as() */
+
+typedef int (SSEH_CCONV* sseh_merge_patch_as_t) (int, const void*, size_t);
+
 /******************************************************************************/
 
+/**
+ * Report the registry changes made after given generation.
+ *
+ * Each mutation of the registry (e.g. #sseh_map_name(), #sseh_detour(),
+ * #sseh_merge_patch(), new profiles and etc.) is journaled as RFC 6902
+ * operations and increments a generation counter. Applying the reported
+ * operations to a copy of the registry taken at @param generation, brings it
+ * in sync, without a need to pull and compare the whole document.
+ *
+ * The journal is bounded, also #sseh_load() can not be expressed as a list of
+ * operations. In these cases this function fails and the client is expected to
+ * retrieve the whole registry through #sseh_identify() and @param current.
+ *
+ * @see https://tools.ietf.org/html/rfc6902
+ *
+ * @param[in] generation already known by the caller, zero initially
+ * @param[out] current (optional) generation of the last change
+ * @param[in,out] size (optional) number of bytes of the incoming @param json
+ * array. On exit reports how many bytes were actually used (w/o the
+ * terminating null) or how many bytes are needed to store the whole result
+ * (again, w/o the terminating null).
+ * @param[out] json (optional) array of the operations
+ * @returns non-zero on success, otherwise see #sseh_last_error ()
+ */
+
+SSEH_API int SSEH_CCONV
+sseh_changes_since (uint64_t generation, uint64_t* current, size_t* size, char* json);
+
+/** @see #sseh_changes_since() */
+
+typedef int (SSEH_CCONV* sseh_changes_since_t) (uint64_t, uint64_t*, size_t*, char*);
+
+/******************************************************************************/
+
+/**
+ * Find the instructions which reference the target of a given name.
+ *
+ * The code sections of the module containing the target are decoded once,
+ * on the first call for it, in parallel. They are read from the module file,
+ * so the patches made in memory by detours or other plugins hide nothing.
+ * The resulting index is stored in "data\skse\plugins\sse-hooks\cache"
+ * under the hash of the module headers, so the next runs of the same module
+ * build only read it back. If the file can't be read, the code in memory is
+ * decoded and the index is not stored. Decoding is linear, hence data
+ * embedded in the code may rarely yield a false reference.
+ *
+ * @param[in] name to search the references for, see #sseh_find_target()
+ * @param[in] kinds of the instructions to report, a mask of SSEH_XREF_*
+ * @param[in,out] count of the @param callers array. On exit reports how many
+ * references were found, which may be more than the ones stored.
+ * @param[out] callers (optional) addresses of the referencing instructions,
+ * in ascending order.
+ * @returns non-zero on success, otherwise see #sseh_last_error ()
+ */
+
+SSEH_API int SSEH_CCONV
+sseh_find_callers (const char* name, int kinds, size_t* count, uintptr_t* callers);
+
+/** @see #sseh_find_callers() */
+
+typedef int (SSEH_CCONV* sseh_find_callers_t) (const char*, int, size_t*, uintptr_t*);
+
+/******************************************************************************/
+
+/**
+ * Memory held by SSEH, as reported by #sseh_execute() for the "memory" command.
+ *
+ * The caller sets @ref size to the size of the structure it knows. Fields are
+ * only appended in later versions and only those which fit in @ref size are
+ * filled in.
+ */
+
+struct sseh_memory
+{
+    /** Of this structure, set by the caller */
+    size_t size;
+    /** Bytes of the arena blocks backing the registry */
+    size_t registry_reserved;
+    /** Of them, bytes handed out to the registry nodes */
+    size_t registry_used;
+    /** Bytes of the Address Library id to offset table */
+    size_t addrlib_ids;
+    /** Bytes of the Address Library name to id table, with the strings */
+    size_t addrlib_names;
+    /** Count of the profiles */
+    size_t profiles;
+    /** Count of the detours over all profiles */
+    size_t hooks;
+    /** Bytes of the hook tables over all profiles */
+    size_t hook_tables;
+    /** Bytes of the committed executable blocks for relays and trampolines */
+    size_t exec_committed;
+    /** Count of the slots in these blocks, each for one detour */
+    size_t exec_slots;
+    /** Of them, the slots in use */
+    size_t exec_slots_used;
+    /** Bytes of the largest buffer of suspended threads, they are freed after each use */
+    size_t frozen_threads;
+};
+
+/**
+ * Text result of #sseh_execute() commands.
+ *
+ * On input @ref size is the number of bytes @ref text can hold. On exit reports
+ * how many bytes were actually used or how many are needed for the whole text,
+ * both including the terminating null, same as #sseh_identify().
+ */
+
+struct sseh_text
+{
+    /** Of @ref text in bytes */
+    size_t size;
+    /** Optional, can be nullptr to get only the needed @ref size */
+    char* text;
+};
+
 /**
  * Execute custom command.
  *
  * This is highly implementation specific and may change any moment. It is like
- * patch hole for development use.
+ * patch hole for development use. Known commands:
+ *
+ * - "memory" with @param arg pointing to #sseh_memory, cheap enough to be called
+ *   each frame
+ * - "stats" counts of names, detours, profiles and journaled changes, as JSON in
+ *   optional #sseh_text
+ * - "benchmark" timings of the registry queries on the mapped names, as JSON in
+ *   optional #sseh_text
+ * - "flush-log" writes out the pending log lines (only in SKSE)
+ * - "snapshot-save" with @param arg a file path to write the registry into, as
+ *   CBOR or MessagePack if the path ends with .cbor or .msgpack, else as JSON
+ * - "verify" validates the registry and walks the detour chains. Fails if some
+ *   detour is not reachable from its target. The names of such targets are
+ *   reported as JSON in optional #sseh_text.
+ * - "large-pages" makes the trampolines, created from now on, carved from large
+ *   pages near their targets. Fails if the process can't lock pages in memory.
+ * - "relayout" moves the relays of the enabled detours with "/map/<name>/calls"
+ *   counts in the registry next to each other, the most called first. The counts
+ *   of moved and counted targets are reported as JSON in optional #sseh_text.
+ * - "vtables" maps "<Class>::vtbl" to each virtual table of the game, found
+ *   through its RTTI. Existing names are left as they are. The counts of found
+ *   and mapped tables are reported as JSON in optional #sseh_text.
  *
  * @param[in] command identifier
  * @param[in,out] arg to pass in or out data
@@ -460,6 +740,20 @@ struct sseh_api_v1
     sseh_merge_patch_t merge_patch;
 	/** @see #sseh_execute() */
 	sseh_execute_t execute;
+	/** @see #sseh_identify_as() */
+	sseh_identify_as_t identify_as;
+	/** @see #sseh_merge_patch_as() */
+	sseh_merge_patch_as_t merge_patch_as;
+	/** @see #sseh_changes_since() */
+	sseh_changes_since_t changes_since;
+	/** @see #sseh_detour_priority() */
+	sseh_detour_priority_t detour_priority;
+	/** @see #sseh_find_callers() */
+	sseh_find_callers_t find_callers;
+	/** @see #sseh_find_targets() */
+	sseh_find_targets_t find_targets;
+	/** @see #sseh_find_targets_by_id() */
+	sseh_find_targets_by_id_t find_targets_by_id;
 };
 
 /** Points to the current API version in use. */
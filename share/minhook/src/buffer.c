@@ -35,6 +35,9 @@
 // Max range for seeking a memory block. (= 1024MB)
 #define MAX_MEMORY_RANGE 0x40000000
 
+// Size of each region reserved ahead, see ReserveBuffer(). (= 16MB)
+#define MEMORY_RESERVE_SIZE 0x1000000
+
 // Memory protection flags to check the executable address.
 #define PAGE_EXECUTE_FLAGS \
     (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)
@@ -55,8 +58,45 @@ typedef struct _MEMORY_BLOCK
     struct _MEMORY_BLOCK *pNext;
     PMEMORY_SLOT pFree;         // First element of the free slot list.
     UINT usedCount;
+    LPBYTE pWritable;           // Writable view of the block, NULL if the block itself is.
+    struct _MEMORY_REGION *pRegion; // Region the block was carved from, or NULL.
+#if defined(_M_X64) || defined(__x86_64__)
+    PVOID hFunctionTable;       // Unwind data registered for the block, or NULL.
+    PRUNTIME_FUNCTION pFunctions; // Its entries, two per slot, see SetBufferUnwindInfo().
+    DWORD leafUnwindInfo;       // UNWIND_INFO of the code pushing nothing.
+#endif
 } MEMORY_BLOCK, *PMEMORY_BLOCK;
 
+// The header takes the place of the first slot of its block.
+C_ASSERT(sizeof(MEMORY_BLOCK) <= MEMORY_SLOT_SIZE);
+
+// Range mapped at once, which blocks are carved from.
+typedef struct _MEMORY_REGION
+{
+    LPBYTE pBase;               // Executable view, NULL if the region is not in use.
+    LPBYTE pWritable;           // Writable view.
+    SIZE_T size;
+    SIZE_T carved;              // Bytes from pBase handed out as blocks so far.
+    SIZE_T committed;           // Bytes from pBase committed so far.
+    PMEMORY_BLOCK pFree;        // Blocks given back, to be handed out again.
+    UINT usedCount;             // Blocks handed out and not given back.
+} MEMORY_REGION, *PMEMORY_REGION;
+
+// Max count of the regions.
+#define MAX_MEMORY_REGIONS 64
+
+#if defined(_M_X64) || defined(__x86_64__)
+// Count of the entries in the function table of a block.
+#define MEMORY_BLOCK_FUNCTIONS (2 * (MEMORY_BLOCK_SIZE / MEMORY_SLOT_SIZE - 1))
+
+// UNWIND_INFO version 1, no flags, no prolog and no unwind codes.
+#define LEAF_UNWIND_INFO 1
+
+typedef DWORD(WINAPI *ADD_GROWABLE_FUNCTION_TABLE)(PVOID *, PRUNTIME_FUNCTION, DWORD, DWORD,
+    ULONG_PTR, ULONG_PTR);
+typedef VOID(WINAPI *DELETE_GROWABLE_FUNCTION_TABLE)(PVOID);
+#endif
+
 //-------------------------------------------------------------------------
 // Global Variables:
 //-------------------------------------------------------------------------
@@ -64,10 +104,209 @@ typedef struct _MEMORY_BLOCK
 // First element of the memory block list.
 PMEMORY_BLOCK g_pMemoryBlocks;
 
+// Regions, unlike the block lists shared by all the profiles.
+static MEMORY_REGION g_regions[MAX_MEMORY_REGIONS];
+
+// Whether to make large page regions, see UseLargePages().
+static BOOL g_largePages = FALSE;
+
+// While packing, the head of the block list before it started, see PackBuffers().
+static BOOL g_packing = FALSE;
+static PMEMORY_BLOCK g_pPackedSince = NULL;
+
+#if defined(_M_X64) || defined(__x86_64__)
+// Exported by ntdll since Windows 8, the blocks have no unwind data before.
+static ADD_GROWABLE_FUNCTION_TABLE g_pAddFunctionTable = NULL;
+static DELETE_GROWABLE_FUNCTION_TABLE g_pDeleteFunctionTable = NULL;
+#endif
+
 //-------------------------------------------------------------------------
 VOID InitializeBuffer(VOID)
 {
-    // Nothing to do for now.
+#if defined(_M_X64) || defined(__x86_64__)
+    HMODULE hNtdll = GetModuleHandleW(L"ntdll.dll");
+    if (hNtdll != NULL)
+    {
+        g_pAddFunctionTable = (ADD_GROWABLE_FUNCTION_TABLE)
+            GetProcAddress(hNtdll, "RtlAddGrowableFunctionTable");
+        g_pDeleteFunctionTable = (DELETE_GROWABLE_FUNCTION_TABLE)
+            GetProcAddress(hNtdll, "RtlDeleteGrowableFunctionTable");
+    }
+    if (g_pDeleteFunctionTable == NULL)
+        g_pAddFunctionTable = NULL;
+#endif
+}
+
+//-------------------------------------------------------------------------
+// Registers the unwind data of a block, so stack walks, exceptions and
+// profilers can step through its code. Each slot starts out as two leaf
+// functions, the relay and the trampoline of the hooks, see
+// SetBufferUnwindInfo(). If it fails, the block goes without, as all of them
+// do before Windows 8.
+static VOID RegisterBlock(PMEMORY_BLOCK pBlock)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    PMEMORY_BLOCK pHeader = (PMEMORY_BLOCK)WritableBuffer(pBlock);
+    PRUNTIME_FUNCTION pFunctions;
+    PVOID hTable;
+    DWORD i;
+
+    pHeader->hFunctionTable = NULL;
+    pHeader->pFunctions = NULL;
+    pHeader->leafUnwindInfo = LEAF_UNWIND_INFO;
+
+    if (g_pAddFunctionTable == NULL)
+        return;
+
+    pFunctions = (PRUNTIME_FUNCTION)HeapAlloc(
+        GetProcessHeap(), 0, MEMORY_BLOCK_FUNCTIONS * sizeof(RUNTIME_FUNCTION));
+    if (pFunctions == NULL)
+        return;
+
+    // Relative to the block, the first slot holds the header.
+    for (i = 0; i < MEMORY_BLOCK_FUNCTIONS; ++i)
+    {
+        pFunctions[i].BeginAddress = MEMORY_SLOT_SIZE + i * (MEMORY_SLOT_SIZE / 2);
+        pFunctions[i].EndAddress = pFunctions[i].BeginAddress + MEMORY_SLOT_SIZE / 2;
+        pFunctions[i].UnwindData = offsetof(MEMORY_BLOCK, leafUnwindInfo);
+    }
+
+    if (g_pAddFunctionTable(&hTable, pFunctions, MEMORY_BLOCK_FUNCTIONS,
+        MEMORY_BLOCK_FUNCTIONS, (ULONG_PTR)pBlock, (ULONG_PTR)pBlock + MEMORY_BLOCK_SIZE) != 0)
+    {
+        HeapFree(GetProcessHeap(), 0, pFunctions);
+        return;
+    }
+
+    pHeader->hFunctionTable = hTable;
+    pHeader->pFunctions = pFunctions;
+#else
+    UNREFERENCED_PARAMETER(pBlock);
+#endif
+}
+
+//-------------------------------------------------------------------------
+static VOID UnregisterBlock(PMEMORY_BLOCK pBlock)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    PMEMORY_BLOCK pHeader = (PMEMORY_BLOCK)WritableBuffer(pBlock);
+    if (pBlock->pFunctions != NULL)
+    {
+        g_pDeleteFunctionTable(pBlock->hFunctionTable);
+        HeapFree(GetProcessHeap(), 0, pBlock->pFunctions);
+        pHeader->hFunctionTable = NULL;
+        pHeader->pFunctions = NULL;
+    }
+#else
+    UNREFERENCED_PARAMETER(pBlock);
+#endif
+}
+
+//-------------------------------------------------------------------------
+// The code of a buffer from pCode on, up to the end of its slot, unwinds by
+// the UNWIND_INFO at pInfo, which is in the same block. The code before it
+// is a leaf function, as is all of it if pInfo is NULL.
+VOID SetBufferUnwindInfo(LPVOID pCode, LPVOID pInfo)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    PMEMORY_BLOCK pBlock = (PMEMORY_BLOCK)(
+        ((ULONG_PTR)pCode / MEMORY_BLOCK_SIZE) * MEMORY_BLOCK_SIZE);
+    DWORD offset = (DWORD)((LPBYTE)pCode - (LPBYTE)pBlock);
+    PRUNTIME_FUNCTION pFunction;
+
+    if (pBlock->pFunctions == NULL)
+        return;
+
+    // The entries stay ordered, moving the bound between the two of a slot.
+    pFunction = pBlock->pFunctions + (offset / MEMORY_SLOT_SIZE - 1) * 2;
+    pFunction[0].EndAddress = offset;
+    pFunction[1].BeginAddress = offset;
+    pFunction[1].UnwindData = pInfo != NULL
+        ? (DWORD)((LPBYTE)pInfo - (LPBYTE)pBlock) : offsetof(MEMORY_BLOCK, leafUnwindInfo);
+#else
+    UNREFERENCED_PARAMETER(pCode);
+    UNREFERENCED_PARAMETER(pInfo);
+#endif
+}
+
+//-------------------------------------------------------------------------
+// Maps a new block twice, read-execute at pAddress (anywhere if NULL) and
+// read-write anywhere, so no page is writable and executable at once. If
+// the section can't be created, falls back to a single RWX block.
+static PMEMORY_BLOCK AllocateBlock(LPVOID pAddress)
+{
+    PMEMORY_BLOCK pBlock;
+    LPBYTE pWritable = NULL;
+
+    HANDLE hSection = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+        PAGE_EXECUTE_READWRITE | SEC_COMMIT, 0, MEMORY_BLOCK_SIZE, NULL);
+    if (hSection == NULL)
+    {
+        pBlock = (PMEMORY_BLOCK)VirtualAlloc(
+            pAddress, MEMORY_BLOCK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+    }
+    else
+    {
+        pBlock = (PMEMORY_BLOCK)MapViewOfFileEx(
+            hSection, FILE_MAP_READ | FILE_MAP_EXECUTE, 0, 0, MEMORY_BLOCK_SIZE, pAddress);
+        if (pBlock != NULL)
+        {
+            pWritable = (LPBYTE)MapViewOfFile(hSection, FILE_MAP_WRITE, 0, 0, MEMORY_BLOCK_SIZE);
+            if (pWritable == NULL)
+            {
+                UnmapViewOfFile(pBlock);
+                pBlock = NULL;
+            }
+        }
+
+        // The views keep the section alive.
+        CloseHandle(hSection);
+    }
+
+    if (pBlock != NULL)
+    {
+        PMEMORY_BLOCK pHeader = pWritable != NULL ? (PMEMORY_BLOCK)pWritable : pBlock;
+        pHeader->pWritable = pWritable;
+        pHeader->pRegion = NULL;
+    }
+
+    return pBlock;
+}
+
+//-------------------------------------------------------------------------
+static VOID ReleaseBlock(PMEMORY_BLOCK pBlock)
+{
+    PMEMORY_REGION pRegion = pBlock->pRegion;
+
+    UnregisterBlock(pBlock);
+
+    if (pRegion != NULL)
+    {
+        ((PMEMORY_BLOCK)WritableBuffer(pBlock))->pNext = pRegion->pFree;
+        pRegion->pFree = pBlock;
+        pRegion->usedCount--;
+    }
+    else if (pBlock->pWritable != NULL)
+    {
+        UnmapViewOfFile(pBlock->pWritable);
+        UnmapViewOfFile(pBlock);
+    }
+    else
+    {
+        VirtualFree(pBlock, 0, MEM_RELEASE);
+    }
+}
+
+//-------------------------------------------------------------------------
+LPVOID WritableBuffer(LPVOID pAddress)
+{
+    PMEMORY_BLOCK pBlock = (PMEMORY_BLOCK)(
+        ((ULONG_PTR)pAddress / MEMORY_BLOCK_SIZE) * MEMORY_BLOCK_SIZE);
+
+    if (pBlock->pWritable == NULL)
+        return pAddress;
+
+    return pBlock->pWritable + ((LPBYTE)pAddress - (LPBYTE)pBlock);
 }
 
 //-------------------------------------------------------------------------
@@ -79,9 +318,21 @@ VOID UninitializeBuffer(VOID)
     while (pBlock)
     {
         PMEMORY_BLOCK pNext = pBlock->pNext;
-        VirtualFree(pBlock, 0, MEM_RELEASE);
+        ReleaseBlock(pBlock);
         pBlock = pNext;
     }
+
+    // The regions no profile has blocks in anymore.
+    for (UINT i = 0; i < MAX_MEMORY_REGIONS; ++i)
+    {
+        PMEMORY_REGION pRegion = &g_regions[i];
+        if (pRegion->pBase != NULL && pRegion->usedCount == 0)
+        {
+            UnmapViewOfFile(pRegion->pWritable);
+            UnmapViewOfFile(pRegion->pBase);
+            pRegion->pBase = NULL;
+        }
+    }
 }
 
 //-------------------------------------------------------------------------
@@ -148,10 +399,182 @@ static LPVOID FindNextFreeRegion(LPVOID pAddress, LPVOID pMaxAddr, DWORD dwAlloc
 #endif
 
 //-------------------------------------------------------------------------
-static PMEMORY_BLOCK GetMemoryBlock(LPVOID pOrigin)
+// Hands out a block of a region, the first one within minAddr and maxAddr.
+static PMEMORY_BLOCK CarveBlock(ULONG_PTR minAddr, ULONG_PTR maxAddr)
 {
-    PMEMORY_BLOCK pBlock;
+    for (UINT i = 0; i < MAX_MEMORY_REGIONS; ++i)
+    {
+        PMEMORY_REGION pRegion = &g_regions[i];
+        PMEMORY_BLOCK pBlock = pRegion->pFree;
+        if (pRegion->pBase == NULL)
+            continue;
+
+        if (pBlock != NULL && (ULONG_PTR)pBlock >= minAddr && (ULONG_PTR)pBlock < maxAddr)
+        {
+            pRegion->pFree = pBlock->pNext;
+        }
+        else if (pRegion->carved < pRegion->size
+            && (ULONG_PTR)pRegion->pBase + pRegion->carved >= minAddr
+            && (ULONG_PTR)pRegion->pBase + pRegion->carved < maxAddr)
+        {
+            PMEMORY_BLOCK pHeader = (PMEMORY_BLOCK)(pRegion->pWritable + pRegion->carved);
+            pBlock = (PMEMORY_BLOCK)(pRegion->pBase + pRegion->carved);
+
+            // Reserved regions are committed a block at a time, in both views.
+            if (pRegion->carved >= pRegion->committed)
+            {
+                if (VirtualAlloc(pBlock, MEMORY_BLOCK_SIZE, MEM_COMMIT, PAGE_EXECUTE_READ) == NULL
+                    || VirtualAlloc(pHeader, MEMORY_BLOCK_SIZE, MEM_COMMIT, PAGE_READWRITE) == NULL)
+                    continue;
+                pRegion->committed += MEMORY_BLOCK_SIZE;
+            }
+
+            pHeader->pWritable = (LPBYTE)pHeader;
+            pHeader->pRegion = pRegion;
+            pRegion->carved += MEMORY_BLOCK_SIZE;
+        }
+        else
+        {
+            continue;
+        }
+
+        pRegion->usedCount++;
+        return pBlock;
+    }
+
+    return NULL;
+}
+
+//-------------------------------------------------------------------------
+// Lets the process lock pages in memory, which is needed to allocate large
+// pages. Fails unless the user has the "Lock pages in memory" right.
+static BOOL EnableLockMemoryPrivilege(VOID)
+{
+    HANDLE hToken;
+    TOKEN_PRIVILEGES tp;
+    BOOL result;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &hToken))
+        return FALSE;
+
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    result = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid)
+        && AdjustTokenPrivileges(hToken, FALSE, &tp, 0, NULL, NULL)
+        && GetLastError() == ERROR_SUCCESS;
+
+    CloseHandle(hToken);
+    return result;
+}
+
+//-------------------------------------------------------------------------
+// New blocks of all the profiles are carved from large page regions, if the
+// process may lock pages. Returns whether it may.
+BOOL UseLargePages(BOOL enable)
+{
+    g_largePages = enable && GetLargePageMinimum() != 0 && EnableLockMemoryPrivilege();
+    return g_largePages;
+}
+
+//-------------------------------------------------------------------------
+// Maps a view of a region as close to pOrigin within minAddr and maxAddr as
+// possible, at a multiple of the given granularity. NULL if there is no room.
+static LPBYTE MapRegionView(HANDLE hSection, DWORD access, SIZE_T size, DWORD granularity,
+    LPVOID pOrigin, ULONG_PTR minAddr, ULONG_PTR maxAddr)
+{
+    LPBYTE pBase = NULL;
+#if defined(_M_X64) || defined(__x86_64__)
+    LPVOID pAlloc = pOrigin;
+    while (pBase == NULL && (ULONG_PTR)pAlloc >= minAddr)
+    {
+        pAlloc = FindPrevFreeRegion(pAlloc, (LPVOID)minAddr, granularity);
+        if (pAlloc == NULL)
+            break;
+        pBase = (LPBYTE)MapViewOfFileEx(hSection, access, 0, 0, size, pAlloc);
+    }
+
+    pAlloc = pOrigin;
+    while (pBase == NULL && (ULONG_PTR)pAlloc <= maxAddr)
+    {
+        pAlloc = FindNextFreeRegion(pAlloc, (LPVOID)maxAddr, granularity);
+        if (pAlloc == NULL)
+            break;
+        pBase = (LPBYTE)MapViewOfFileEx(hSection, access, 0, 0, size, pAlloc);
+    }
+#else
+    UNREFERENCED_PARAMETER(granularity);
+    UNREFERENCED_PARAMETER(pOrigin);
+    UNREFERENCED_PARAMETER(minAddr);
+    UNREFERENCED_PARAMETER(maxAddr);
+    pBase = (LPBYTE)MapViewOfFile(hSection, access, 0, 0, size);
+#endif
+    return pBase;
+}
+
+//-------------------------------------------------------------------------
+// Maps a single large page twice, read-execute as close to pOrigin within
+// minAddr and maxAddr as possible and read-write anywhere. If it fails, the
+// large pages are not tried anymore.
+static BOOL CreateLargePageRegion(LPVOID pOrigin, ULONG_PTR minAddr, ULONG_PTR maxAddr)
+{
+    SIZE_T size = GetLargePageMinimum();
+    DWORD access = FILE_MAP_READ | FILE_MAP_EXECUTE | FILE_MAP_LARGE_PAGES;
+    PMEMORY_REGION pRegion = NULL;
+    LPBYTE pBase = NULL;
+    LPBYTE pWritable = NULL;
+    HANDLE hSection;
+
+    for (UINT i = 0; i < MAX_MEMORY_REGIONS && pRegion == NULL; ++i)
+    {
+        if (g_regions[i].pBase == NULL)
+            pRegion = &g_regions[i];
+    }
+    if (pRegion == NULL)
+        return FALSE;
+
+    hSection = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+        PAGE_EXECUTE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES, 0, (DWORD)size, NULL);
+    if (hSection == NULL)
+    {
+        g_largePages = FALSE;
+        return FALSE;
+    }
+
+    pBase = MapRegionView(hSection, access, size, (DWORD)size, pOrigin, minAddr, maxAddr);
+    if (pBase != NULL)
+    {
+        pWritable = (LPBYTE)MapViewOfFile(
+            hSection, FILE_MAP_WRITE | FILE_MAP_LARGE_PAGES, 0, 0, size);
+        if (pWritable == NULL)
+        {
+            UnmapViewOfFile(pBase);
+            pBase = NULL;
+        }
+    }
+
+    CloseHandle(hSection);
+
+    if (pBase == NULL)
+    {
+        g_largePages = FALSE;
+        return FALSE;
+    }
+
+    pRegion->pBase = pBase;
+    pRegion->pWritable = pWritable;
+    pRegion->size = size;
+    pRegion->carved = 0;
+    pRegion->committed = size;
+    pRegion->pFree = NULL;
+    pRegion->usedCount = 0;
+    return TRUE;
+}
+
+//-------------------------------------------------------------------------
 #if defined(_M_X64) || defined(__x86_64__)
+// The range of the block addresses reachable from pOrigin.
+static VOID GetReachableRange(LPVOID pOrigin, ULONG_PTR *pMinAddr, ULONG_PTR *pMaxAddr)
+{
     ULONG_PTR minAddr;
     ULONG_PTR maxAddr;
 
@@ -169,11 +592,103 @@ static PMEMORY_BLOCK GetMemoryBlock(LPVOID pOrigin)
 
     // Make room for MEMORY_BLOCK_SIZE bytes.
     maxAddr -= MEMORY_BLOCK_SIZE - 1;
+
+    *pMinAddr = minAddr;
+    *pMaxAddr = maxAddr;
+}
 #endif
 
-    // Look the registered blocks for a reachable one.
+//-------------------------------------------------------------------------
+// Reserves a region for the blocks of the targets around pOrigin, e.g. the
+// base of a module, unless one reachable from there has room left. It is
+// mapped as the large page regions are, but its pages are committed only
+// as the blocks are carved. Once reserved, no hook around pOrigin has to
+// probe the address space for a new block.
+BOOL ReserveBuffer(LPVOID pOrigin)
+{
+    PMEMORY_REGION pRegion = NULL;
+    LPBYTE pBase = NULL;
+    LPBYTE pWritable = NULL;
+    HANDLE hSection;
+    ULONG_PTR minAddr = 0;
+    ULONG_PTR maxAddr = (ULONG_PTR)-1;
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+#if defined(_M_X64) || defined(__x86_64__)
+    GetReachableRange(pOrigin, &minAddr, &maxAddr);
+#endif
+
+    for (UINT i = 0; i < MAX_MEMORY_REGIONS; ++i)
+    {
+        PMEMORY_REGION p = &g_regions[i];
+        if (p->pBase == NULL)
+        {
+            if (pRegion == NULL)
+                pRegion = p;
+        }
+        else if (p->carved < p->size
+            && (ULONG_PTR)p->pBase + p->carved >= minAddr
+            && (ULONG_PTR)p->pBase + p->carved < maxAddr)
+        {
+            return TRUE;
+        }
+    }
+    if (pRegion == NULL)
+        return FALSE;
+
+    hSection = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+        PAGE_EXECUTE_READWRITE | SEC_RESERVE, 0, MEMORY_RESERVE_SIZE, NULL);
+    if (hSection == NULL)
+        return FALSE;
+
+    pBase = MapRegionView(hSection, FILE_MAP_READ | FILE_MAP_EXECUTE, MEMORY_RESERVE_SIZE,
+        si.dwAllocationGranularity, pOrigin, minAddr, maxAddr);
+    if (pBase != NULL)
+    {
+        pWritable = (LPBYTE)MapViewOfFile(hSection, FILE_MAP_WRITE, 0, 0, MEMORY_RESERVE_SIZE);
+        if (pWritable == NULL)
+        {
+            UnmapViewOfFile(pBase);
+            pBase = NULL;
+        }
+    }
+
+    CloseHandle(hSection);
+
+    if (pBase == NULL)
+        return FALSE;
+
+    pRegion->pBase = pBase;
+    pRegion->pWritable = pWritable;
+    pRegion->size = MEMORY_RESERVE_SIZE;
+    pRegion->carved = 0;
+    pRegion->committed = 0;
+    pRegion->pFree = NULL;
+    pRegion->usedCount = 0;
+    return TRUE;
+}
+
+//-------------------------------------------------------------------------
+static PMEMORY_BLOCK GetMemoryBlock(LPVOID pOrigin)
+{
+    PMEMORY_BLOCK pBlock;
+#if defined(_M_X64) || defined(__x86_64__)
+    ULONG_PTR minAddr;
+    ULONG_PTR maxAddr;
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    GetReachableRange(pOrigin, &minAddr, &maxAddr);
+#endif
+
+    // Look the registered blocks for a reachable one. While packing, only
+    // the ones made since it started.
     for (pBlock = g_pMemoryBlocks; pBlock != NULL; pBlock = pBlock->pNext)
     {
+        if (g_packing && pBlock == g_pPackedSince)
+            break;
+
 #if defined(_M_X64) || defined(__x86_64__)
         // Ignore the blocks too far.
         if ((ULONG_PTR)pBlock < minAddr || (ULONG_PTR)pBlock >= maxAddr)
@@ -184,8 +699,20 @@ static PMEMORY_BLOCK GetMemoryBlock(LPVOID pOrigin)
             return pBlock;
     }
 
+    // Carve a new block from the regions, making a large page one if needed.
+#if defined(_M_X64) || defined(__x86_64__)
+    pBlock = CarveBlock(minAddr, maxAddr);
+    if (pBlock == NULL && g_largePages && CreateLargePageRegion(pOrigin, minAddr, maxAddr))
+        pBlock = CarveBlock(minAddr, maxAddr);
+#else
+    pBlock = CarveBlock(0, (ULONG_PTR)-1);
+    if (pBlock == NULL && g_largePages && CreateLargePageRegion(pOrigin, 0, (ULONG_PTR)-1))
+        pBlock = CarveBlock(0, (ULONG_PTR)-1);
+#endif
+
 #if defined(_M_X64) || defined(__x86_64__)
     // Alloc a new block above if not found.
+    if (pBlock == NULL)
     {
         LPVOID pAlloc = pOrigin;
         while ((ULONG_PTR)pAlloc >= minAddr)
@@ -194,8 +721,7 @@ static PMEMORY_BLOCK GetMemoryBlock(LPVOID pOrigin)
             if (pAlloc == NULL)
                 break;
 
-            pBlock = (PMEMORY_BLOCK)VirtualAlloc(
-                pAlloc, MEMORY_BLOCK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+            pBlock = AllocateBlock(pAlloc);
             if (pBlock != NULL)
                 break;
         }
@@ -211,32 +737,34 @@ static PMEMORY_BLOCK GetMemoryBlock(LPVOID pOrigin)
             if (pAlloc == NULL)
                 break;
 
-            pBlock = (PMEMORY_BLOCK)VirtualAlloc(
-                pAlloc, MEMORY_BLOCK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+            pBlock = AllocateBlock(pAlloc);
             if (pBlock != NULL)
                 break;
         }
     }
 #else
     // In x86 mode, a memory block can be placed anywhere.
-    pBlock = (PMEMORY_BLOCK)VirtualAlloc(
-        NULL, MEMORY_BLOCK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+    if (pBlock == NULL)
+        pBlock = AllocateBlock(NULL);
 #endif
 
     if (pBlock != NULL)
     {
-        // Build a linked list of all the slots.
+        // Build a linked list of all the slots, through the writable view.
+        PMEMORY_BLOCK pHeader = (PMEMORY_BLOCK)WritableBuffer(pBlock);
         PMEMORY_SLOT pSlot = (PMEMORY_SLOT)pBlock + 1;
-        pBlock->pFree = NULL;
-        pBlock->usedCount = 0;
+        pHeader->pFree = NULL;
+        pHeader->usedCount = 0;
         do
         {
-            pSlot->pNext = pBlock->pFree;
-            pBlock->pFree = pSlot;
+            ((PMEMORY_SLOT)WritableBuffer(pSlot))->pNext = pHeader->pFree;
+            pHeader->pFree = pSlot;
             pSlot++;
         } while ((ULONG_PTR)pSlot - (ULONG_PTR)pBlock <= MEMORY_BLOCK_SIZE - MEMORY_SLOT_SIZE);
 
-        pBlock->pNext = g_pMemoryBlocks;
+        RegisterBlock(pBlock);
+
+        pHeader->pNext = g_pMemoryBlocks;
         g_pMemoryBlocks = pBlock;
     }
 
@@ -252,16 +780,27 @@ LPVOID AllocateBuffer(LPVOID pOrigin)
         return NULL;
 
     // Remove an unused slot from the list.
+    PMEMORY_BLOCK pHeader = (PMEMORY_BLOCK)WritableBuffer(pBlock);
     pSlot = pBlock->pFree;
-    pBlock->pFree = pSlot->pNext;
-    pBlock->usedCount++;
+    pHeader->pFree = pSlot->pNext;
+    pHeader->usedCount++;
 #ifdef _DEBUG
     // Fill the slot with INT3 for debugging.
-    memset(pSlot, 0xCC, sizeof(MEMORY_SLOT));
+    memset(WritableBuffer(pSlot), 0xCC, sizeof(MEMORY_SLOT));
 #endif
     return pSlot;
 }
 
+//-------------------------------------------------------------------------
+// While enabled, the buffers are allocated only from the blocks made since,
+// one after the other, rather than from the free slots of the older blocks.
+// Nothing may be freed until it is disabled again.
+VOID PackBuffers(BOOL enable)
+{
+    g_packing = enable;
+    g_pPackedSince = enable ? g_pMemoryBlocks : NULL;
+}
+
 //-------------------------------------------------------------------------
 VOID FreeBuffer(LPVOID pBuffer)
 {
@@ -273,25 +812,26 @@ VOID FreeBuffer(LPVOID pBuffer)
     {
         if ((ULONG_PTR)pBlock == pTargetBlock)
         {
+            PMEMORY_BLOCK pHeader = (PMEMORY_BLOCK)WritableBuffer(pBlock);
             PMEMORY_SLOT pSlot = (PMEMORY_SLOT)pBuffer;
 #ifdef _DEBUG
             // Clear the released slot for debugging.
-            memset(pSlot, 0x00, sizeof(*pSlot));
+            memset(WritableBuffer(pSlot), 0x00, sizeof(*pSlot));
 #endif
             // Restore the released slot to the list.
-            pSlot->pNext = pBlock->pFree;
-            pBlock->pFree = pSlot;
-            pBlock->usedCount--;
+            ((PMEMORY_SLOT)WritableBuffer(pSlot))->pNext = pBlock->pFree;
+            pHeader->pFree = pSlot;
+            pHeader->usedCount--;
 
             // Free if unused.
             if (pBlock->usedCount == 0)
             {
                 if (pPrev)
-                    pPrev->pNext = pBlock->pNext;
+                    ((PMEMORY_BLOCK)WritableBuffer(pPrev))->pNext = pBlock->pNext;
                 else
                     g_pMemoryBlocks = pBlock->pNext;
 
-                VirtualFree(pBlock, 0, MEM_RELEASE);
+                ReleaseBlock(pBlock);
             }
 
             break;
@@ -302,6 +842,24 @@ VOID FreeBuffer(LPVOID pBuffer)
     }
 }
 
+//-------------------------------------------------------------------------
+VOID GetBufferUsage(SIZE_T *pCommitted, UINT *pSlots, UINT *pUsedSlots)
+{
+    PMEMORY_BLOCK pBlock;
+
+    *pCommitted = 0;
+    *pSlots = 0;
+    *pUsedSlots = 0;
+
+    for (pBlock = g_pMemoryBlocks; pBlock != NULL; pBlock = pBlock->pNext)
+    {
+        // The first slot sized part holds the block header.
+        *pCommitted += MEMORY_BLOCK_SIZE;
+        *pSlots += MEMORY_BLOCK_SIZE / MEMORY_SLOT_SIZE - 1;
+        *pUsedSlots += pBlock->usedCount;
+    }
+}
+
 //-------------------------------------------------------------------------
 BOOL IsExecutableAddress(LPVOID pAddress)
 {
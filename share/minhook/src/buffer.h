@@ -39,4 +39,10 @@ VOID   InitializeBuffer(VOID);
 VOID   UninitializeBuffer(VOID);
 LPVOID AllocateBuffer(LPVOID pOrigin);
 VOID   FreeBuffer(LPVOID pBuffer);
+VOID   PackBuffers(BOOL enable);
+LPVOID WritableBuffer(LPVOID pAddress);
+BOOL   UseLargePages(BOOL enable);
+BOOL   ReserveBuffer(LPVOID pOrigin);
 BOOL   IsExecutableAddress(LPVOID pAddress);
+VOID   SetBufferUnwindInfo(LPVOID pCode, LPVOID pInfo);
+VOID   GetBufferUsage(SIZE_T *pCommitted, UINT *pSlots, UINT *pUsedSlots);
@@ -30,6 +30,10 @@
 #include <tlhelp32.h>
 #include <limits.h>
 #include <cstddef>
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
 
 #include "../include/MinHook.h"
 #include "buffer.h"
@@ -78,21 +82,20 @@ typedef struct _EXEC_BUFFER
 
 #pragma pack(pop)
 
-// Hook information.
+// Hook information, the rarely accessed part. The target address and the
+// enabled/queued states are kept in separate arrays of g_hooks.
 typedef struct _HOOK_ENTRY
 {
-    LPVOID pTarget;             // Address of the target function.
     LPVOID pDetour;             // Address of the detour function.
     PEXEC_BUFFER pExecBuffer;   // Address of the executable buffer for relay and trampoline.
-
-    UINT8  isEnabled   : 1;     // Enabled.
-    UINT8  queueEnable : 1;     // Queued for enabling/disabling when != isEnabled.
+    PEXEC_BUFFER pRelay;        // Buffer of the relay in use, pExecBuffer unless laid out anew.
 
     UINT8  backup[8];           // Original prologue of the target function.
     BOOL   patchAbove;          // Uses the hot patch area.
     UINT   nIP : 4;             // Count of the instruction boundaries.
     UINT8  oldIPs[8];           // Instruction boundaries of the target function.
     UINT8  newIPs[8];           // Instruction boundaries of the trampoline function.
+    INT    priority;            // Higher ones are kept closer to the callers of the target.
 } HOOK_ENTRY, *PHOOK_ENTRY;
 
 //-------------------------------------------------------------------------
@@ -105,15 +108,27 @@ HANDLE g_hMutex = NULL;
 // Private heap handle.
 HANDLE g_hHeap;
 
-// Hook entries.
+// Hook entries, as parallel arrays indexed by the hook position.
 struct
 {
+    LPVOID*     pTargets;   // Addresses of the target functions, searched on each lookup
+    UINT64*     pEnabled;   // Bit per hook, set when enabled
+    UINT64*     pQueued;    // Bit per hook, queued for enabling/disabling when != pEnabled
     PHOOK_ENTRY pItems;     // Data heap
     UINT        capacity;   // Size of allocated data heap, items
     UINT        size;       // Actual number of data items
 } g_hooks;
 
+// Largest buffer of thread handles made by a Freeze so far, in bytes.
+// Unlike the rest, it is shared by all the profiles.
+static SIZE_T g_frozenThreadsPeak = 0;
+
+// Count of UINT64 words in a bitset of the given count of hooks.
+#define HOOK_BIT_WORDS(n) (((n) + 63) / 64)
+
 #include <map>
+#include <vector>
+#include <algorithm>
 struct _MEMORY_BLOCK;
 void switch_globals (std::size_t i)
 {
@@ -127,24 +142,95 @@ void switch_globals (std::size_t i)
     static std::map<std::size_t,globals> g;
     if (!g.empty () && last_i == i)
         return;
+    // Park the active state under its own index, then bring in the requested one.
+    globals& from = g[last_i];
+    globals& to = g[i];
     last_i = i;
-    globals* v;
-    if (g.count (i)) v = &g[i];
-    else v = &g.emplace (i, globals {}).first->second;
-    std::swap (g_hMutex, v->mutex);
-    std::swap (g_hHeap, v->heap);
-    std::swap (g_hooks, v->hooks);
-    std::swap (g_pMemoryBlocks, v->memory);
+    std::swap (g_hMutex, from.mutex);
+    std::swap (g_hHeap, from.heap);
+    std::swap (g_hooks, from.hooks);
+    std::swap (g_pMemoryBlocks, from.memory);
+    std::swap (g_hMutex, to.mutex);
+    std::swap (g_hHeap, to.heap);
+    std::swap (g_hooks, to.hooks);
+    std::swap (g_pMemoryBlocks, to.memory);
+}
+
+//-------------------------------------------------------------------------
+static inline BOOL GetHookBit(const UINT64 *pBits, UINT pos)
+{
+    return (pBits[pos / 64] >> (pos % 64)) & 1;
+}
+
+//-------------------------------------------------------------------------
+static inline VOID SetHookBit(UINT64 *pBits, UINT pos, BOOL value)
+{
+    if (value)
+        pBits[pos / 64] |= (UINT64)1 << (pos % 64);
+    else
+        pBits[pos / 64] &= ~((UINT64)1 << (pos % 64));
+}
+
+//-------------------------------------------------------------------------
+// Index of the lowest set bit, the value must not be zero.
+static inline UINT LowestHookBit(UINT64 bits)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(__x86_64__))
+    unsigned long i;
+    _BitScanForward64(&i, bits);
+    return i;
+#elif defined(_MSC_VER)
+    unsigned long i;
+    if (_BitScanForward(&i, (unsigned long)bits))
+        return i;
+    _BitScanForward(&i, (unsigned long)(bits >> 32));
+    return i + 32;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+//-------------------------------------------------------------------------
+// Bits of the existing hooks in the given word of a bitset.
+static inline UINT64 ValidHookBits(UINT word)
+{
+    UINT rest = g_hooks.size - word * 64;
+    return rest >= 64 ? ~(UINT64)0 : ((UINT64)1 << rest) - 1;
 }
 
 //-------------------------------------------------------------------------
 // Returns INVALID_HOOK_POS if not found.
 static UINT FindHookEntry(LPVOID pTarget)
 {
-    UINT i;
-    for (i = 0; i < g_hooks.size; ++i)
+    UINT i = 0;
+
+    // Compare 16 bytes of targets at once. Targets in the same module share
+    // their upper halves, so a match needs all the lanes of one pointer.
+#if defined(_M_X64) || defined(__x86_64__)
+    __m128i key = _mm_set1_epi64x((LONG_PTR)pTarget);
+    for (; i + 4 <= g_hooks.size; i += 4)
+    {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&g_hooks.pTargets[i]), key);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&g_hooks.pTargets[i + 2]), key);
+        UINT mask = (UINT)_mm_movemask_epi8(a) | ((UINT)_mm_movemask_epi8(b) << 16);
+        mask &= (mask >> 4) & 0x0F0F0F0F;
+        if (mask != 0)
+            return i + LowestHookBit(mask) / 8;
+    }
+#else
+    __m128i key = _mm_set1_epi32((LONG_PTR)pTarget);
+    for (; i + 4 <= g_hooks.size; i += 4)
+    {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&g_hooks.pTargets[i]), key);
+        UINT mask = (UINT)_mm_movemask_epi8(a);
+        if (mask != 0)
+            return i + LowestHookBit(mask) / 4;
+    }
+#endif
+
+    for (; i < g_hooks.size; ++i)
     {
-        if ((ULONG_PTR)pTarget == (ULONG_PTR)g_hooks.pItems[i].pTarget)
+        if ((ULONG_PTR)pTarget == (ULONG_PTR)g_hooks.pTargets[i])
             return i;
     }
 
@@ -152,78 +238,117 @@ static UINT FindHookEntry(LPVOID pTarget)
 }
 
 //-------------------------------------------------------------------------
-static PHOOK_ENTRY AddHookEntry()
+// Allocates or reallocates one of the hook arrays, NULL on failure.
+static LPVOID ResizeHookArray(LPVOID p, SIZE_T size, DWORD flags)
+{
+    if (p == NULL)
+        return HeapAlloc(g_hHeap, flags, size);
+    return HeapReAlloc(g_hHeap, flags, p, size);
+}
+
+//-------------------------------------------------------------------------
+// Fits all the hook arrays to the given capacity. On failure, some of them
+// may be left bigger than requested, which is harmless.
+static BOOL ResizeHookArrays(UINT capacity)
+{
+    LPVOID p;
+
+    if ((p = ResizeHookArray(g_hooks.pTargets, capacity * sizeof(LPVOID), 0)) == NULL)
+        return FALSE;
+    g_hooks.pTargets = (LPVOID*)p;
+
+    // New bit words must be zero, as nothing is enabled or queued there.
+    if ((p = ResizeHookArray(g_hooks.pEnabled, HOOK_BIT_WORDS(capacity) * sizeof(UINT64), HEAP_ZERO_MEMORY)) == NULL)
+        return FALSE;
+    g_hooks.pEnabled = (UINT64*)p;
+
+    if ((p = ResizeHookArray(g_hooks.pQueued, HOOK_BIT_WORDS(capacity) * sizeof(UINT64), HEAP_ZERO_MEMORY)) == NULL)
+        return FALSE;
+    g_hooks.pQueued = (UINT64*)p;
+
+    if ((p = ResizeHookArray(g_hooks.pItems, capacity * sizeof(HOOK_ENTRY), 0)) == NULL)
+        return FALSE;
+    g_hooks.pItems = (PHOOK_ENTRY)p;
+
+    return TRUE;
+}
+
+//-------------------------------------------------------------------------
+// Returns INVALID_HOOK_POS if out of memory.
+static UINT AddHookEntry()
 {
     if (g_hooks.pItems == NULL)
     {
+        if (!ResizeHookArrays(INITIAL_HOOK_CAPACITY))
+            return INVALID_HOOK_POS;
         g_hooks.capacity = INITIAL_HOOK_CAPACITY;
-        g_hooks.pItems = (PHOOK_ENTRY)HeapAlloc(
-            g_hHeap, 0, g_hooks.capacity * sizeof(HOOK_ENTRY));
-        if (g_hooks.pItems == NULL)
-            return NULL;
     }
     else if (g_hooks.size >= g_hooks.capacity)
     {
-        PHOOK_ENTRY p = (PHOOK_ENTRY)HeapReAlloc(
-            g_hHeap, 0, g_hooks.pItems, (g_hooks.capacity * 2) * sizeof(HOOK_ENTRY));
-        if (p == NULL)
-            return NULL;
-
+        if (!ResizeHookArrays(g_hooks.capacity * 2))
+            return INVALID_HOOK_POS;
         g_hooks.capacity *= 2;
-        g_hooks.pItems = p;
     }
 
-    return &g_hooks.pItems[g_hooks.size++];
+    return g_hooks.size++;
 }
 
 //-------------------------------------------------------------------------
 static void DeleteHookEntry(UINT pos)
 {
-    if (pos < g_hooks.size - 1)
-        g_hooks.pItems[pos] = g_hooks.pItems[g_hooks.size - 1];
+    UINT last = g_hooks.size - 1;
+    if (pos < last)
+    {
+        g_hooks.pTargets[pos] = g_hooks.pTargets[last];
+        g_hooks.pItems[pos] = g_hooks.pItems[last];
+        SetHookBit(g_hooks.pEnabled, pos, GetHookBit(g_hooks.pEnabled, last));
+        SetHookBit(g_hooks.pQueued, pos, GetHookBit(g_hooks.pQueued, last));
+    }
+
+    // Keep the bits past the end clear.
+    SetHookBit(g_hooks.pEnabled, last, FALSE);
+    SetHookBit(g_hooks.pQueued, last, FALSE);
 
     g_hooks.size--;
 
     if (g_hooks.capacity / 2 >= INITIAL_HOOK_CAPACITY && g_hooks.capacity / 2 >= g_hooks.size)
     {
-        PHOOK_ENTRY p = (PHOOK_ENTRY)HeapReAlloc(
-            g_hHeap, 0, g_hooks.pItems, (g_hooks.capacity / 2) * sizeof(HOOK_ENTRY));
-        if (p == NULL)
-            return;
-
+        ResizeHookArrays(g_hooks.capacity / 2);
         g_hooks.capacity /= 2;
-        g_hooks.pItems = p;
     }
 }
 
 //-------------------------------------------------------------------------
-static DWORD_PTR FindOldIP(PHOOK_ENTRY pHook, DWORD_PTR ip)
+static DWORD_PTR FindOldIP(UINT pos, DWORD_PTR ip)
 {
+    PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+    LPVOID pTarget = g_hooks.pTargets[pos];
     UINT i;
 
-    if (pHook->patchAbove && ip == ((DWORD_PTR)pHook->pTarget - sizeof(JMP_REL)))
-        return (DWORD_PTR)pHook->pTarget;
+    if (pHook->patchAbove && ip == ((DWORD_PTR)pTarget - sizeof(JMP_REL)))
+        return (DWORD_PTR)pTarget;
 
     for (i = 0; i < pHook->nIP; ++i)
     {
         if (ip == ((DWORD_PTR)pHook->pExecBuffer->trampoline + pHook->newIPs[i]))
-            return (DWORD_PTR)pHook->pTarget + pHook->oldIPs[i];
+            return (DWORD_PTR)pTarget + pHook->oldIPs[i];
     }
 
     // Check relay function.
-    if (ip == (DWORD_PTR)&pHook->pExecBuffer->jmpRelay)
-        return (DWORD_PTR)pHook->pTarget;
+    if (ip == (DWORD_PTR)&pHook->pExecBuffer->jmpRelay || ip == (DWORD_PTR)&pHook->pRelay->jmpRelay)
+        return (DWORD_PTR)pTarget;
 
     return 0;
 }
 
 //-------------------------------------------------------------------------
-static DWORD_PTR FindNewIP(PHOOK_ENTRY pHook, DWORD_PTR ip)
+static DWORD_PTR FindNewIP(UINT pos, DWORD_PTR ip)
 {
+    PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
     UINT i;
     for (i = 0; i < pHook->nIP; ++i)
     {
-        if (ip == ((DWORD_PTR)pHook->pTarget + pHook->oldIPs[i]))
+        if (ip == ((DWORD_PTR)g_hooks.pTargets[pos] + pHook->oldIPs[i]))
             return (DWORD_PTR)pHook->pExecBuffer->trampoline + pHook->newIPs[i];
     }
 
@@ -242,7 +367,6 @@ static void ProcessThreadIPs(HANDLE hThread, UINT pos, BOOL enable)
 #else
     DWORD       *pIP = &c.Eip;
 #endif
-    PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
     DWORD_PTR   ip;
 
     c.ContextFlags = CONTEXT_CONTROL;
@@ -250,9 +374,9 @@ static void ProcessThreadIPs(HANDLE hThread, UINT pos, BOOL enable)
         return;
 
     if (enable)
-        ip = FindNewIP(pHook, *pIP);
+        ip = FindNewIP(pos, *pIP);
     else
-        ip = FindOldIP(pHook, *pIP);
+        ip = FindOldIP(pos, *pIP);
 
     if (ip != 0)
     {
@@ -313,6 +437,9 @@ static VOID EnumerateThreads(PFROZEN_THREADS pThreads)
         }
         CloseHandle(hSnapshot);
     }
+
+    if (pThreads->capacity * sizeof(HANDLE) > g_frozenThreadsPeak)
+        g_frozenThreadsPeak = pThreads->capacity * sizeof(HANDLE);
 }
 
 //-------------------------------------------------------------------------
@@ -368,7 +495,7 @@ static MH_STATUS CreateHookTrampoline(UINT pos)
     PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
 
     TRAMPOLINE ct;
-    ct.pTarget = pHook->pTarget;
+    ct.pTarget = g_hooks.pTargets[pos];
     ct.pTrampoline = pHook->pExecBuffer->trampoline;
     ct.trampolineSize = sizeof(pHook->pExecBuffer->trampoline);
     if (!CreateTrampolineFunction(&ct))
@@ -381,12 +508,12 @@ static MH_STATUS CreateHookTrampoline(UINT pos)
     {
         memcpy(
             pHook->backup,
-            (LPBYTE)pHook->pTarget - sizeof(JMP_REL),
+            (LPBYTE)ct.pTarget - sizeof(JMP_REL),
             sizeof(JMP_REL) + sizeof(JMP_REL_SHORT));
     }
     else
     {
-        memcpy(pHook->backup, pHook->pTarget, sizeof(JMP_REL));
+        memcpy(pHook->backup, ct.pTarget, sizeof(JMP_REL));
     }
 
     pHook->patchAbove = ct.patchAbove;
@@ -394,6 +521,9 @@ static MH_STATUS CreateHookTrampoline(UINT pos)
     memcpy(pHook->oldIPs, ct.oldIPs, ARRAYSIZE(ct.oldIPs));
     memcpy(pHook->newIPs, ct.newIPs, ARRAYSIZE(ct.newIPs));
 
+    // The relay before the trampoline pushes nothing.
+    SetBufferUnwindInfo(ct.pTrampoline, CreateTrampolineUnwindInfo(&ct));
+
     return MH_OK;
 }
 
@@ -403,7 +533,8 @@ static MH_STATUS WINAPI EnableHookLL(UINT pos, BOOL enable, PFROZEN_THREADS pThr
     PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
     DWORD  oldProtect;
     SIZE_T patchSize    = sizeof(JMP_REL);
-    LPBYTE pPatchTarget = (LPBYTE)pHook->pTarget;
+    LPVOID pTarget      = g_hooks.pTargets[pos];
+    LPBYTE pPatchTarget = (LPBYTE)pTarget;
 
     if (!enable)
     {
@@ -411,10 +542,10 @@ static MH_STATUS WINAPI EnableHookLL(UINT pos, BOOL enable, PFROZEN_THREADS pThr
         if (pJmp->opcode == 0xE9)
         {
             PJMP_RELAY pJmpRelay = (PJMP_RELAY)(((LPBYTE)pJmp + sizeof(JMP_REL)) + (INT32)pJmp->operand);
-            if (&pHook->pExecBuffer->jmpRelay != pJmpRelay)
+            if (&pHook->pRelay->jmpRelay != pJmpRelay)
             {
                 PEXEC_BUFFER pOtherExecBuffer = (PEXEC_BUFFER)((LPBYTE)pJmpRelay - offsetof(EXEC_BUFFER, jmpRelay));
-                return pOtherExecBuffer->pDisableHookChain(pHook->pTarget, pos, EnableHookLL, pThreads);
+                return pOtherExecBuffer->pDisableHookChain(pTarget, pos, EnableHookLL, pThreads);
             }
         }
     }
@@ -438,11 +569,11 @@ static MH_STATUS WINAPI EnableHookLL(UINT pos, BOOL enable, PFROZEN_THREADS pThr
     {
         PJMP_REL pJmp = (PJMP_REL)pPatchTarget;
         pJmp->opcode = 0xE9;
-        pJmp->operand = (UINT32)((LPBYTE)&pHook->pExecBuffer->jmpRelay - (pPatchTarget + sizeof(JMP_REL)));
+        pJmp->operand = (UINT32)((LPBYTE)&pHook->pRelay->jmpRelay - (pPatchTarget + sizeof(JMP_REL)));
 
         if (pHook->patchAbove)
         {
-            PJMP_REL_SHORT pShortJmp = (PJMP_REL_SHORT)pHook->pTarget;
+            PJMP_REL_SHORT pShortJmp = (PJMP_REL_SHORT)pTarget;
             pShortJmp->opcode = 0xEB;
             pShortJmp->operand = (UINT8)(0 - (sizeof(JMP_REL_SHORT) + sizeof(JMP_REL)));
         }
@@ -462,23 +593,38 @@ static MH_STATUS WINAPI EnableHookLL(UINT pos, BOOL enable, PFROZEN_THREADS pThr
 
     ProcessFrozenThreads(pThreads, pos, enable);
 
-    pHook->isEnabled   = enable;
-    pHook->queueEnable = enable;
+    SetHookBit(g_hooks.pEnabled, pos, enable);
+    SetHookBit(g_hooks.pQueued, pos, enable);
 
     return MH_OK;
 }
 
 //-------------------------------------------------------------------------
-static MH_STATUS EnableAllHooksLL(BOOL enable)
+// Hooks to change in the given word of the bitsets: the enabled ones if
+// pWanted is NULL and disable is set, the disabled ones if pWanted is NULL
+// and disable is not set, otherwise the ones whose state differs from pWanted.
+static inline UINT64 PendingHookBits(const UINT64 *pWanted, BOOL enable, UINT word)
+{
+    UINT64 wanted = pWanted != NULL ? pWanted[word] : (enable ? ~(UINT64)0 : 0);
+    return (g_hooks.pEnabled[word] ^ wanted) & ValidHookBits(word);
+}
+
+//-------------------------------------------------------------------------
+// Brings each hook to the state of its bit in pWanted, or to enable for all
+// of them if pWanted is NULL. Threads are frozen only if there is work to do.
+// Each change is made through EnableLL, same signature as EnableHookLL.
+template<class EnableLL>
+static MH_STATUS ApplyHookBitsLL(const UINT64 *pWanted, BOOL enable, EnableLL enableLL)
 {
     MH_STATUS status = MH_OK;
-    UINT i, first = INVALID_HOOK_POS;
+    UINT words = HOOK_BIT_WORDS(g_hooks.size);
+    UINT w, first = INVALID_HOOK_POS;
 
-    for (i = 0; i < g_hooks.size; ++i)
+    for (w = 0; w < words; ++w)
     {
-        if (g_hooks.pItems[i].isEnabled != enable)
+        if (PendingHookBits(pWanted, enable, w) != 0)
         {
-            first = i;
+            first = w;
             break;
         }
     }
@@ -488,11 +634,15 @@ static MH_STATUS EnableAllHooksLL(BOOL enable)
         FROZEN_THREADS threads;
         Freeze(&threads);
 
-        for (i = first; i < g_hooks.size; ++i)
+        for (w = first; w < words && status == MH_OK; ++w)
         {
-            if (g_hooks.pItems[i].isEnabled != enable)
+            UINT64 pending = PendingHookBits(pWanted, enable, w);
+            while (pending != 0)
             {
-                status = EnableHookLL(i, enable, &threads);
+                UINT pos = w * 64 + LowestHookBit(pending);
+                pending &= pending - 1;
+
+                status = enableLL(pos, pWanted != NULL ? GetHookBit(pWanted, pos) : enable, &threads);
                 if (status != MH_OK)
                     break;
             }
@@ -504,6 +654,12 @@ static MH_STATUS EnableAllHooksLL(BOOL enable)
     return status;
 }
 
+//-------------------------------------------------------------------------
+static MH_STATUS EnableAllHooksLL(BOOL enable)
+{
+    return ApplyHookBitsLL(NULL, enable, EnableHookLL);
+}
+
 //-------------------------------------------------------------------------
 static HANDLE CreateProcessMutex(VOID)
 {
@@ -578,10 +734,16 @@ MH_STATUS WINAPI MH_Uninitialize(VOID)
     // HeapFree is actually not required, but some tools detect a false
     // memory leak without HeapFree.
     UninitializeBuffer();
+    HeapFree(g_hHeap, 0, g_hooks.pTargets);
+    HeapFree(g_hHeap, 0, g_hooks.pEnabled);
+    HeapFree(g_hHeap, 0, g_hooks.pQueued);
     HeapFree(g_hHeap, 0, g_hooks.pItems);
     HeapDestroy(g_hHeap);
     g_hHeap = NULL;
 
+    g_hooks.pTargets = NULL;
+    g_hooks.pEnabled = NULL;
+    g_hooks.pQueued = NULL;
     g_hooks.pItems = NULL;
     g_hooks.capacity = 0;
     g_hooks.size = 0;
@@ -592,6 +754,667 @@ MH_STATUS WINAPI MH_Uninitialize(VOID)
     return MH_OK;
 }
 
+//-------------------------------------------------------------------------
+// The jump of the patch at pTarget, above it if the hot patch area is used.
+// NULL if it is not patched.
+static PJMP_REL FindPatchJumpAt(LPBYTE pTarget)
+{
+    PJMP_REL_SHORT pShortJmp = (PJMP_REL_SHORT)pTarget;
+    if (pShortJmp->opcode == 0xEB
+            && pShortJmp->operand == (UINT8)(0 - (sizeof(JMP_REL_SHORT) + sizeof(JMP_REL))))
+        pTarget -= sizeof(JMP_REL);
+
+    PJMP_REL pJmp = (PJMP_REL)pTarget;
+    if (pJmp->opcode != 0xE9)
+        return NULL;
+
+    return pJmp;
+}
+
+//-------------------------------------------------------------------------
+// Where the patch at pTarget jumps to, NULL if it is not patched.
+static LPBYTE FindPatchJump(LPBYTE pTarget)
+{
+    PJMP_REL pJmp = FindPatchJumpAt(pTarget);
+    if (pJmp == NULL)
+        return NULL;
+
+    return (LPBYTE)pJmp + sizeof(JMP_REL) + (INT32)pJmp->operand;
+}
+
+//-------------------------------------------------------------------------
+// Uninitializes the globals of the first count profiles at once. All the
+// enabled hooks are restored under a single freeze: on each target, the
+// outermost detour first, so no chain has to be unlinked from the middle.
+// Then the memory of all the profiles is released as a whole.
+MH_STATUS uninitialize_globals (std::size_t count)
+{
+    struct enabled_hook
+    {
+        LPVOID      pTarget;
+        LPVOID      pRelay;
+        std::size_t profile;
+        BOOL        restored;
+    };
+    std::vector<enabled_hook> hooks;
+    std::size_t owner = count;  // Profile whose mutex and heap are used.
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        switch_globals (i);
+        if (g_hMutex == NULL)
+            continue;
+        if (owner == count)
+            owner = i;
+
+        UINT w;
+        for (w = 0; w < HOOK_BIT_WORDS(g_hooks.size); ++w)
+        {
+            UINT64 bits;
+            for (bits = g_hooks.pEnabled[w]; bits != 0; bits &= bits - 1)
+            {
+                UINT pos = w * 64 + LowestHookBit(bits);
+                hooks.push_back (enabled_hook {
+                    g_hooks.pTargets[pos], &g_hooks.pItems[pos].pRelay->jmpRelay, i, FALSE });
+            }
+        }
+    }
+
+    if (owner == count)
+        return MH_ERROR_NOT_INITIALIZED;
+
+    switch_globals (owner);
+    HANDLE hMutex = g_hMutex;
+    if (WaitForSingleObject(hMutex, INFINITE) != WAIT_OBJECT_0)
+        return MH_ERROR_MUTEX_FAILURE;
+
+    MH_STATUS status = MH_OK;
+    FROZEN_THREADS threads;
+    Freeze(&threads);
+
+    std::stable_sort (hooks.begin (), hooks.end (), [] (enabled_hook const& a, enabled_hook const& b) {
+        return (ULONG_PTR)a.pTarget < (ULONG_PTR)b.pTarget;
+    });
+
+    for (auto first = hooks.begin (); first != hooks.end () && status == MH_OK; )
+    {
+        auto last = std::find_if (first, hooks.end (), [first] (enabled_hook const& h) {
+            return h.pTarget != first->pTarget;
+        });
+
+        for (auto left = last - first; left > 0 && status == MH_OK; --left)
+        {
+            LPBYTE pRelay = FindPatchJump((LPBYTE)first->pTarget);
+            auto it = std::find_if (first, last, [pRelay] (enabled_hook const& h) {
+                return !h.restored && h.pRelay == pRelay;
+            });
+
+            // Another module patched over ours, unhook the rest the usual way.
+            if (it == last)
+            {
+                it = std::find_if (std::make_reverse_iterator (last), std::make_reverse_iterator (first),
+                        [] (enabled_hook const& h) { return !h.restored; }).base () - 1;
+            }
+
+            switch_globals (it->profile);
+            status = EnableHookLL(FindHookEntry(it->pTarget), FALSE, &threads);
+            it->restored = TRUE;
+        }
+
+        first = last;
+    }
+
+    switch_globals (owner);
+    Unfreeze(&threads);
+    ReleaseMutex(hMutex);
+
+    if (status != MH_OK)
+        return status;
+
+    // Nothing refers to the trampolines anymore. Each private heap goes
+    // as a whole together with the hook tables in it.
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        switch_globals (i);
+        if (g_hMutex == NULL)
+            continue;
+
+        UninitializeBuffer();
+        HeapDestroy(g_hHeap);
+        g_hHeap = NULL;
+
+        g_hooks.pTargets = NULL;
+        g_hooks.pEnabled = NULL;
+        g_hooks.pQueued = NULL;
+        g_hooks.pItems = NULL;
+        g_hooks.capacity = 0;
+        g_hooks.size = 0;
+
+        CloseHandle(g_hMutex);
+        g_hMutex = NULL;
+    }
+
+    return MH_OK;
+}
+
+//-------------------------------------------------------------------------
+// Sets the priority of a created hook of the current profile. It is taken
+// into account the next time the hook gets enabled.
+MH_STATUS prioritize_hook (LPVOID pTarget, INT priority)
+{
+    if (g_hMutex == NULL)
+        return MH_ERROR_NOT_INITIALIZED;
+
+    if (WaitForSingleObject(g_hMutex, INFINITE) != WAIT_OBJECT_0)
+        return MH_ERROR_MUTEX_FAILURE;
+
+    MH_STATUS status = MH_OK;
+
+    UINT pos = FindHookEntry(pTarget);
+    if (pos != INVALID_HOOK_POS)
+        g_hooks.pItems[pos].priority = priority;
+    else
+        status = MH_ERROR_NOT_CREATED;
+
+    ReleaseMutex(g_hMutex);
+
+    return status;
+}
+
+//-------------------------------------------------------------------------
+// An enabled hook of one of the profiles, as found on top of a chain.
+struct chain_link
+{
+    std::size_t profile;
+    UINT        pos;
+    INT         priority;
+    BOOL        queued;
+};
+
+//-------------------------------------------------------------------------
+// Finds which of the first count profiles made the patch at pTarget. Leaves
+// the globals of that profile active. FALSE if the target is not patched,
+// or it is patched by another module.
+static BOOL FindChainTop(LPVOID pTarget, std::size_t count, chain_link *pLink)
+{
+    LPBYTE pRelay = FindPatchJump((LPBYTE)pTarget);
+    if (pRelay == NULL)
+        return FALSE;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        switch_globals (i);
+        if (g_hMutex == NULL)
+            continue;
+
+        UINT pos = FindHookEntry(pTarget);
+        if (pos != INVALID_HOOK_POS && GetHookBit(g_hooks.pEnabled, pos)
+                && (LPBYTE)&g_hooks.pItems[pos].pRelay->jmpRelay == pRelay)
+        {
+            pLink->profile = i;
+            pLink->pos = pos;
+            pLink->priority = g_hooks.pItems[pos].priority;
+            pLink->queued = GetHookBit(g_hooks.pQueued, pos);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//-------------------------------------------------------------------------
+// Where the jump at the start of a trampoline goes, i.e. the relay of the
+// next detour in the chain. NULL if it starts with the original code.
+static LPBYTE FindTrampolineJump(LPBYTE pTrampoline)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    PJMP_ABS_CS pAbs = (PJMP_ABS_CS)pTrampoline;
+    if (pAbs->prefix == 0x2E && pAbs->opcode0 == 0xFF && pAbs->opcode1 == 0x25 && pAbs->dummy == 0)
+        return (LPBYTE)pAbs->address;
+#endif
+    PJMP_REL pRel = (PJMP_REL)pTrampoline;
+    if (pRel->opcode == 0xE9)
+        return pTrampoline + sizeof(JMP_REL) + (INT32)pRel->operand;
+    return NULL;
+}
+
+//-------------------------------------------------------------------------
+// Points the jump at the start of a trampoline to pDest instead. FALSE if
+// it does not start with a jump which can reach any address.
+static BOOL SetTrampolineJump(LPBYTE pTrampoline, LPBYTE pDest)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    PJMP_ABS_CS pAbs = (PJMP_ABS_CS)pTrampoline;
+    if (pAbs->prefix != 0x2E || pAbs->opcode0 != 0xFF || pAbs->opcode1 != 0x25 || pAbs->dummy != 0)
+        return FALSE;
+    ((PJMP_ABS_CS)WritableBuffer(pAbs))->address = (ULONG_PTR)pDest;
+    FlushInstructionCache(GetCurrentProcess(), pAbs, sizeof(JMP_ABS_CS));
+#else
+    PJMP_REL pRel = (PJMP_REL)pTrampoline;
+    if (pRel->opcode != 0xE9)
+        return FALSE;
+    ((PJMP_REL)WritableBuffer(pRel))->operand = (UINT32)(pDest - (pTrampoline + sizeof(JMP_REL)));
+    FlushInstructionCache(GetCurrentProcess(), pRel, sizeof(JMP_REL));
+#endif
+    return TRUE;
+}
+
+//-------------------------------------------------------------------------
+// Makes each trampoline on the chain of pTarget jump straight to the detour
+// of the next enabled hook of the first count profiles, rather than through
+// its relay. The relays stay as they are, the patch at the target still has
+// to reach the detours through them. Disabled hooks are not on the chain at
+// all, so each detour costs a single jump. Threads must be frozen.
+static VOID FlattenChainLL(LPVOID pTarget, std::size_t count)
+{
+    struct chain_hook
+    {
+        LPBYTE pRelay;
+        LPBYTE pDetour;
+        LPBYTE pTrampoline;
+    };
+    std::vector<chain_hook> hooks;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        switch_globals (i);
+        if (g_hMutex == NULL)
+            continue;
+
+        UINT pos = FindHookEntry(pTarget);
+        if (pos != INVALID_HOOK_POS && GetHookBit(g_hooks.pEnabled, pos))
+        {
+            PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+            hooks.push_back (chain_hook {
+                (LPBYTE)&pHook->pRelay->jmpRelay, (LPBYTE)pHook->pDetour,
+                pHook->pExecBuffer->trampoline });
+        }
+    }
+
+    // Each hook is visited at most once, should a foreign detour loop back.
+    LPBYTE pJump = FindPatchJump((LPBYTE)pTarget);
+    for (std::size_t left = hooks.size (); pJump != NULL && left > 0; --left)
+    {
+        auto it = std::find_if (hooks.begin (), hooks.end (), [pJump] (chain_hook const& h) {
+            return h.pRelay == pJump || h.pDetour == pJump;
+        });
+        if (it == hooks.end ())
+            break;
+
+        pJump = FindTrampolineJump(it->pTrampoline);
+        auto next = std::find_if (hooks.begin (), hooks.end (), [pJump] (chain_hook const& h) {
+            return h.pRelay == pJump;
+        });
+        if (next != hooks.end () && SetTrampolineJump(it->pTrampoline, next->pDetour))
+            pJump = next->pDetour;
+    }
+}
+
+//-------------------------------------------------------------------------
+// Enables or disables a hook of the current profile, keeping the chain on
+// its target ordered by priority. The detours which must stay above it are
+// unhooked first, outermost first, and put back afterwards in reverse order.
+// Equal priorities keep the order in which they were applied. Chains of the
+// own profiles are never unlinked from the middle, only foreign detours
+// (e.g. of another module) go through their DisableHookChain. At the end,
+// the chain is flattened while the threads are still frozen.
+static MH_STATUS RelinkHookLL(
+    std::size_t current, std::size_t count, UINT pos, BOOL enable, PFROZEN_THREADS pThreads)
+{
+    LPVOID pTarget = g_hooks.pTargets[pos];
+    INT priority = g_hooks.pItems[pos].priority;
+
+    MH_STATUS status = MH_OK;
+    std::vector<chain_link> above;
+    chain_link top;
+
+    while (status == MH_OK && FindChainTop(pTarget, count, &top))
+    {
+        if (top.profile == current && top.pos == pos)
+            break;
+        if (enable && top.priority <= priority)
+            break;
+        status = EnableHookLL(top.pos, FALSE, pThreads);
+        if (status == MH_OK)
+            above.push_back (top);
+    }
+
+    switch_globals (current);
+    if (status == MH_OK)
+        status = EnableHookLL(pos, enable, pThreads);
+
+    for (auto it = above.rbegin (); it != above.rend (); ++it)
+    {
+        switch_globals (it->profile);
+        MH_STATUS relinked = EnableHookLL(it->pos, TRUE, pThreads);
+        SetHookBit(g_hooks.pQueued, it->pos, it->queued);
+        if (status == MH_OK)
+            status = relinked;
+    }
+
+    FlattenChainLL(pTarget, count);
+    switch_globals (current);
+    return status;
+}
+
+//-------------------------------------------------------------------------
+// Same as MH_ApplyQueued for the current profile, but the chains are kept
+// ordered by priority across the first count profiles.
+MH_STATUS apply_queued_globals (std::size_t current, std::size_t count)
+{
+    switch_globals (current);
+    if (g_hMutex == NULL)
+        return MH_ERROR_NOT_INITIALIZED;
+
+    if (WaitForSingleObject(g_hMutex, INFINITE) != WAIT_OBJECT_0)
+        return MH_ERROR_MUTEX_FAILURE;
+
+    MH_STATUS status = ApplyHookBitsLL(g_hooks.pQueued, FALSE,
+        [current, count] (UINT pos, BOOL enable, PFROZEN_THREADS pThreads) {
+            return RelinkHookLL(current, count, pos, enable, pThreads);
+        });
+
+    ReleaseMutex(g_hMutex);
+
+    return status;
+}
+
+//-------------------------------------------------------------------------
+// Walks the chain of each target, from its patch through the trampolines,
+// and collects the targets whose enabled hooks of the first count profiles
+// are not all reached that way. Returns the count of the enabled hooks.
+std::size_t verify_globals (std::size_t current, std::size_t count, std::vector<LPVOID>& broken)
+{
+    struct enabled_hook
+    {
+        LPVOID pTarget;
+        LPBYTE pRelay;
+        LPBYTE pDetour;
+        LPBYTE pTrampoline;
+        BOOL   reached;
+    };
+    std::vector<enabled_hook> hooks;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        switch_globals (i);
+        if (g_hMutex == NULL)
+            continue;
+
+        UINT w;
+        for (w = 0; w < HOOK_BIT_WORDS(g_hooks.size); ++w)
+        {
+            UINT64 bits;
+            for (bits = g_hooks.pEnabled[w]; bits != 0; bits &= bits - 1)
+            {
+                UINT pos = w * 64 + LowestHookBit(bits);
+                PEXEC_BUFFER pBuffer = g_hooks.pItems[pos].pExecBuffer;
+                hooks.push_back (enabled_hook {
+                    g_hooks.pTargets[pos], (LPBYTE)&g_hooks.pItems[pos].pRelay->jmpRelay,
+                    (LPBYTE)g_hooks.pItems[pos].pDetour, pBuffer->trampoline, FALSE });
+            }
+        }
+    }
+    switch_globals (current);
+
+    std::sort (hooks.begin (), hooks.end (), [] (enabled_hook const& a, enabled_hook const& b) {
+        return (ULONG_PTR)a.pTarget < (ULONG_PTR)b.pTarget;
+    });
+
+    for (auto first = hooks.begin (); first != hooks.end (); )
+    {
+        auto last = std::find_if (first, hooks.end (), [first] (enabled_hook const& h) {
+            return h.pTarget != first->pTarget;
+        });
+
+        LPBYTE pRelay = FindPatchJump((LPBYTE)first->pTarget);
+        while (pRelay != NULL)
+        {
+            auto it = std::find_if (first, last, [pRelay] (enabled_hook const& h) {
+                return !h.reached && (h.pRelay == pRelay || h.pDetour == pRelay);
+            });
+            if (it == last)
+                break;
+            it->reached = TRUE;
+            pRelay = FindTrampolineJump(it->pTrampoline);
+        }
+
+        if (std::any_of (first, last, [] (enabled_hook const& h) { return !h.reached; }))
+            broken.push_back (first->pTarget);
+
+        first = last;
+    }
+
+    return hooks.size ();
+}
+
+//-------------------------------------------------------------------------
+// Points the jump of a patch, found as by FindPatchJumpAt(), to pDest.
+static BOOL SetPatchJump(PJMP_REL pJmp, LPBYTE pDest)
+{
+    DWORD oldProtect;
+    if (!VirtualProtect(pJmp, sizeof(JMP_REL), PAGE_EXECUTE_READWRITE, &oldProtect))
+        return FALSE;
+
+    pJmp->operand = (UINT32)(pDest - ((LPBYTE)pJmp + sizeof(JMP_REL)));
+
+    VirtualProtect(pJmp, sizeof(JMP_REL), oldProtect, &oldProtect);
+    FlushInstructionCache(GetCurrentProcess(), pJmp, sizeof(JMP_REL));
+    return TRUE;
+}
+
+//-------------------------------------------------------------------------
+// If the backup of a hook holds the patch of another one, jumping to pOld,
+// points it to pNew instead. The backup is restored on disabling the hook.
+static VOID RetargetBackup(UINT pos, LPBYTE pOld, LPBYTE pNew)
+{
+    PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+    LPBYTE pAt = (LPBYTE)g_hooks.pTargets[pos];
+    if (pHook->patchAbove)
+        pAt -= sizeof(JMP_REL);
+
+    PJMP_REL pJmp = (PJMP_REL)pHook->backup;
+    if (pJmp->opcode == 0xE9 && pAt + sizeof(JMP_REL) + (INT32)pJmp->operand == pOld)
+        pJmp->operand = (UINT32)(pNew - (pAt + sizeof(JMP_REL)));
+}
+
+//-------------------------------------------------------------------------
+// Moves the relays of the enabled hooks on the given targets, hottest first,
+// into fresh slots next to each other, so the hot ones share as few cache
+// lines and pages as possible. Each profile of the first count gets its own
+// run of slots. The patches, trampolines and backups which jump to the old
+// relays are pointed to the new ones under a single freeze. Relays which
+// nothing on the chain jumps to (e.g. below a flattened trampoline) are left
+// as they are. The old relays stay in their executable buffers, a thread or
+// a foreign detour may be still on its way through them. A hook is moved
+// once, later calls lay out only the rest. Nothing is frozen if no relay is
+// to be moved. Returns the count of the moved.
+std::size_t relayout_globals (std::size_t current, std::size_t count, std::vector<LPVOID> const& hot)
+{
+    struct moved_relay
+    {
+        std::size_t  profile;
+        UINT         pos;
+        LPVOID       pTarget;
+        LPBYTE       pOld;
+        PEXEC_BUFFER pNew;
+        BOOL         moved;
+    };
+    struct chain_hook
+    {
+        std::size_t profile;
+        UINT        pos;
+        LPBYTE      pRelay;
+        LPBYTE      pDetour;
+        LPBYTE      pTrampoline;
+    };
+    std::vector<moved_relay> moves;
+
+    switch_globals (current);
+    HANDLE hMutex = g_hMutex;
+    if (hMutex == NULL || WaitForSingleObject(hMutex, INFINITE) != WAIT_OBJECT_0)
+        return 0;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        switch_globals (i);
+        if (g_hMutex == NULL)
+            continue;
+
+        PackBuffers(TRUE);
+        for (LPVOID pTarget: hot)
+        {
+            UINT pos = FindHookEntry(pTarget);
+            if (pos == INVALID_HOOK_POS || !GetHookBit(g_hooks.pEnabled, pos))
+                continue;
+            PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+            if (pHook->pRelay != pHook->pExecBuffer)
+                continue;
+
+            PEXEC_BUFFER pBuffer = (PEXEC_BUFFER)AllocateBuffer(pTarget);
+            if (pBuffer == NULL)
+                break;
+            ((PEXEC_BUFFER)WritableBuffer(pBuffer))->pDisableHookChain = DisableHookChain;
+            CreateRelayFunction(&pBuffer->jmpRelay, pHook->pDetour);
+
+            moves.push_back (moved_relay {
+                i, pos, pTarget, (LPBYTE)&pHook->pRelay->jmpRelay, pBuffer, FALSE });
+        }
+        PackBuffers(FALSE);
+    }
+
+    std::vector<LPVOID> targets;
+    for (auto const& m: moves)
+        targets.push_back (m.pTarget);
+    std::sort (targets.begin (), targets.end ());
+    targets.erase (std::unique (targets.begin (), targets.end ()), targets.end ());
+
+    // Nothing to move, the threads are left running
+    if (targets.empty ())
+    {
+        switch_globals (current);
+        ReleaseMutex(hMutex);
+        return 0;
+    }
+
+    FROZEN_THREADS threads;
+    Freeze(&threads);
+
+    for (LPVOID pTarget: targets)
+    {
+        std::vector<chain_hook> hooks;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            switch_globals (i);
+            if (g_hMutex == NULL)
+                continue;
+
+            UINT pos = FindHookEntry(pTarget);
+            if (pos != INVALID_HOOK_POS && GetHookBit(g_hooks.pEnabled, pos))
+            {
+                PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+                hooks.push_back (chain_hook {
+                    i, pos, (LPBYTE)&pHook->pRelay->jmpRelay, (LPBYTE)pHook->pDetour,
+                    pHook->pExecBuffer->trampoline });
+            }
+        }
+
+        // Walk the chain from the patch, retargeting each jump to a moved
+        // relay. A foreign detour on the way ends it, the relays below are
+        // then left where they are.
+        PJMP_REL pPatch = FindPatchJumpAt((LPBYTE)pTarget);
+        LPBYTE pJump = FindPatchJump((LPBYTE)pTarget);
+        LPBYTE pTrampoline = NULL;
+        for (std::size_t left = hooks.size (); pJump != NULL && left > 0; --left)
+        {
+            auto it = std::find_if (hooks.begin (), hooks.end (), [pJump] (chain_hook const& h) {
+                return h.pRelay == pJump || h.pDetour == pJump;
+            });
+            if (it == hooks.end ())
+                break;
+
+            auto m = std::find_if (moves.begin (), moves.end (), [it] (moved_relay const& r) {
+                return r.profile == it->profile && r.pos == it->pos;
+            });
+            if (m != moves.end () && it->pRelay == pJump)
+            {
+                LPBYTE pNew = (LPBYTE)&m->pNew->jmpRelay;
+                m->moved = pTrampoline == NULL
+                    ? SetPatchJump(pPatch, pNew) : SetTrampolineJump(pTrampoline, pNew);
+            }
+
+            pTrampoline = it->pTrampoline;
+            pJump = FindTrampolineJump(pTrampoline);
+        }
+
+        for (auto const& m: moves)
+        {
+            if (m.pTarget != pTarget || !m.moved)
+                continue;
+            for (auto const& h: hooks)
+            {
+                switch_globals (h.profile);
+                RetargetBackup(h.pos, m.pOld, (LPBYTE)&m.pNew->jmpRelay);
+            }
+        }
+    }
+
+    std::size_t moved = 0;
+    for (auto const& m: moves)
+    {
+        if (m.moved)
+        {
+            switch_globals (m.profile);
+            g_hooks.pItems[m.pos].pRelay = m.pNew;
+            ++moved;
+        }
+    }
+
+    for (LPVOID pTarget: targets)
+        FlattenChainLL(pTarget, count);
+
+    switch_globals (current);
+    Unfreeze(&threads);
+
+    for (auto const& m: moves)
+    {
+        if (!m.moved)
+        {
+            switch_globals (m.profile);
+            FreeBuffer(m.pNew);
+        }
+    }
+
+    switch_globals (current);
+    ReleaseMutex(hMutex);
+
+    return moved;
+}
+
+//-------------------------------------------------------------------------
+// Adds what the current profile uses to the given counters: the bytes of
+// its hook tables, its hooks, the bytes of its trampoline blocks, their
+// slots and the slots in use. Returns the largest frozen threads buffer.
+std::size_t account_globals (std::size_t* tables, std::size_t* hooks,
+        std::size_t* committed, std::size_t* slots, std::size_t* usedSlots)
+{
+    if (g_hMutex != NULL)
+    {
+        *tables += g_hooks.capacity * (sizeof(LPVOID) + sizeof(HOOK_ENTRY))
+            + 2 * HOOK_BIT_WORDS(g_hooks.capacity) * sizeof(UINT64);
+        *hooks += g_hooks.size;
+
+        SIZE_T blockBytes;
+        UINT blockSlots, blockUsedSlots;
+        GetBufferUsage(&blockBytes, &blockSlots, &blockUsedSlots);
+        *committed += blockBytes;
+        *slots += blockSlots;
+        *usedSlots += blockUsedSlots;
+    }
+
+    return g_frozenThreadsPeak;
+}
+
 //-------------------------------------------------------------------------
 MH_STATUS WINAPI MH_CreateHook(LPVOID pTarget, LPVOID pDetour, LPVOID *ppOriginal)
 {
@@ -611,17 +1434,18 @@ MH_STATUS WINAPI MH_CreateHook(LPVOID pTarget, LPVOID pDetour, LPVOID *ppOrigina
             PEXEC_BUFFER pBuffer = (PEXEC_BUFFER) AllocateBuffer(pTarget);
             if (pBuffer != NULL)
             {
-                pBuffer->pDisableHookChain = DisableHookChain;
+                ((PEXEC_BUFFER)WritableBuffer(pBuffer))->pDisableHookChain = DisableHookChain;
                 CreateRelayFunction(&pBuffer->jmpRelay, pDetour);
 
-                PHOOK_ENTRY pHook = AddHookEntry();
-                if (pHook != NULL)
+                pos = AddHookEntry();
+                if (pos != INVALID_HOOK_POS)
                 {
-                    pHook->pTarget = pTarget;
+                    PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+                    g_hooks.pTargets[pos] = pTarget;
                     pHook->pDetour = pDetour;
                     pHook->pExecBuffer = pBuffer;
-                    pHook->isEnabled = FALSE;
-                    pHook->queueEnable = FALSE;
+                    pHook->pRelay = pBuffer;
+                    pHook->priority = 0;
 
                     if (ppOriginal != NULL)
                         *ppOriginal = pBuffer->trampoline;
@@ -670,7 +1494,7 @@ MH_STATUS WINAPI MH_RemoveHook(LPVOID pTarget)
     UINT pos = FindHookEntry(pTarget);
     if (pos != INVALID_HOOK_POS)
     {
-        if (g_hooks.pItems[pos].isEnabled)
+        if (GetHookBit(g_hooks.pEnabled, pos))
         {
             FROZEN_THREADS threads;
             Freeze(&threads);
@@ -682,7 +1506,10 @@ MH_STATUS WINAPI MH_RemoveHook(LPVOID pTarget)
 
         if (status == MH_OK)
         {
-            FreeBuffer(g_hooks.pItems[pos].pExecBuffer);
+            PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+            if (pHook->pRelay != pHook->pExecBuffer)
+                FreeBuffer(pHook->pRelay);
+            FreeBuffer(pHook->pExecBuffer);
             DeleteHookEntry(pos);
         }
     }
@@ -706,7 +1533,7 @@ static MH_STATUS WINAPI DisableHookChain(LPVOID pTarget, UINT parentPos, ENABLE_
     if (pos == INVALID_HOOK_POS)
         return MH_ERROR_NOT_CREATED;
 
-    if (!g_hooks.pItems[pos].isEnabled)
+    if (!GetHookBit(g_hooks.pEnabled, pos))
         return MH_ERROR_DISABLED;
 
     // We're not Freeze()-ing the threads here, because we assume that the function
@@ -744,7 +1571,7 @@ static MH_STATUS EnableHook(LPVOID pTarget, BOOL enable)
         UINT pos = FindHookEntry(pTarget);
         if (pos != INVALID_HOOK_POS)
         {
-            if (g_hooks.pItems[pos].isEnabled != enable)
+            if (GetHookBit(g_hooks.pEnabled, pos) != enable)
             {
                 Freeze(&threads);
 
@@ -793,16 +1620,16 @@ static MH_STATUS QueueHook(LPVOID pTarget, BOOL queueEnable)
 
     if (pTarget == MH_ALL_HOOKS)
     {
-        UINT i;
-        for (i = 0; i < g_hooks.size; ++i)
-            g_hooks.pItems[i].queueEnable = queueEnable;
+        UINT w;
+        for (w = 0; w < HOOK_BIT_WORDS(g_hooks.size); ++w)
+            g_hooks.pQueued[w] = queueEnable ? ValidHookBits(w) : 0;
     }
     else
     {
         UINT pos = FindHookEntry(pTarget);
         if (pos != INVALID_HOOK_POS)
         {
-            g_hooks.pItems[pos].queueEnable = queueEnable;
+            SetHookBit(g_hooks.pQueued, pos, queueEnable);
         }
         else
         {
@@ -836,36 +1663,7 @@ MH_STATUS WINAPI MH_ApplyQueued(VOID)
     if (WaitForSingleObject(g_hMutex, INFINITE) != WAIT_OBJECT_0)
         return MH_ERROR_MUTEX_FAILURE;
 
-    MH_STATUS status = MH_OK;
-    UINT i, first = INVALID_HOOK_POS;
-
-    for (i = 0; i < g_hooks.size; ++i)
-    {
-        if (g_hooks.pItems[i].isEnabled != g_hooks.pItems[i].queueEnable)
-        {
-            first = i;
-            break;
-        }
-    }
-
-    if (first != INVALID_HOOK_POS)
-    {
-        FROZEN_THREADS threads;
-        Freeze(&threads);
-
-        for (i = first; i < g_hooks.size; ++i)
-        {
-            PHOOK_ENTRY pHook = &g_hooks.pItems[i];
-            if (pHook->isEnabled != pHook->queueEnable)
-            {
-                status = EnableHookLL(i, pHook->queueEnable, &threads);
-                if (status != MH_OK)
-                    break;
-            }
-        }
-
-        Unfreeze(&threads);
-    }
+    MH_STATUS status = ApplyHookBitsLL(g_hooks.pQueued, FALSE, EnableHookLL);
 
     ReleaseMutex(g_hMutex);
 
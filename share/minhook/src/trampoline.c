@@ -45,6 +45,17 @@
 #include "trampoline.h"
 #include "buffer.h"
 
+// Finds the end of the function holding an address, NULL if not known.
+// Called with the other threads suspended, so it must neither allocate
+// nor take any lock.
+static LPVOID (*g_pFindFunctionEnd)(LPVOID) = NULL;
+
+//-------------------------------------------------------------------------
+VOID SetFunctionEndFinder(LPVOID (*pFind)(LPVOID))
+{
+    g_pFindFunctionEnd = pFind;
+}
+
 //-------------------------------------------------------------------------
 static BOOL IsCodePadding(LPBYTE pInst, UINT size)
 {
@@ -61,6 +72,33 @@ static BOOL IsCodePadding(LPBYTE pInst, UINT size)
     return TRUE;
 }
 
+//-------------------------------------------------------------------------
+#if defined(_M_X64) || defined(__x86_64__)
+// Count of the 16-bit slots taken by an unwind code, from its second byte,
+// the operation and its info. 0 if the operation is not known.
+static UINT UnwindCodeSlots(UINT8 opAndInfo)
+{
+    switch (opAndInfo & 0x0F)
+    {
+    case 0:     // UWOP_PUSH_NONVOL
+    case 2:     // UWOP_ALLOC_SMALL
+    case 3:     // UWOP_SET_FPREG
+    case 10:    // UWOP_PUSH_MACHFRAME
+        return 1;
+    case 1:     // UWOP_ALLOC_LARGE
+        return (opAndInfo >> 4) == 0 ? 2 : 3;
+    case 4:     // UWOP_SAVE_NONVOL
+    case 8:     // UWOP_SAVE_XMM128
+        return 2;
+    case 5:     // UWOP_SAVE_NONVOL_FAR
+    case 9:     // UWOP_SAVE_XMM128_FAR
+        return 3;
+    default:
+        return 0;
+    }
+}
+#endif
+
 //-------------------------------------------------------------------------
 VOID CreateRelayFunction(PJMP_RELAY pJmpRelay, LPVOID pDetour)
 {
@@ -80,7 +118,7 @@ VOID CreateRelayFunction(PJMP_RELAY pJmpRelay, LPVOID pDetour)
     jmp.operand = (UINT32)((LPBYTE)pDetour - ((LPBYTE)pJmpRelay + sizeof(jmp)));
 #endif
 
-    memcpy(pJmpRelay, &jmp, sizeof(jmp));
+    memcpy(WritableBuffer(pJmpRelay), &jmp, sizeof(jmp));
 }
 
 //-------------------------------------------------------------------------
@@ -92,14 +130,14 @@ BOOL CreateTrampolineFunction(PTRAMPOLINE ct)
         0xEB, 0x08,             // EB 08:         JMP +10
         0x0000000000000000ULL   // Absolute destination address
     };
-    JMP_ABS jmp = {
-        0xFF, 0x25, 0x00000000, // FF25 00000000: JMP [RIP+6]
-        0x0000000000000000ULL   // Absolute destination address
+    JMP_ABS_CS jmp = {
+        0x2E, 0xFF, 0x25, 0x00000000, // 2E FF25 00000000: JMP CS:[RIP+7]
+        0x0000000000000000ULL         // Absolute destination address
     };
     JCC_ABS jcc = {
-        0x70, 0x0E,             // 7* 0E:         J** +16
-        0xFF, 0x25, 0x00000000, // FF25 00000000: JMP [RIP+6]
-        0x0000000000000000ULL   // Absolute destination address
+        0x70, 0x0F,                   // 7* 0F:            J** +17
+        0x2E, 0xFF, 0x25, 0x00000000, // 2E FF25 00000000: JMP CS:[RIP+7]
+        0x0000000000000000ULL         // Absolute destination address
     };
 #else
     CALL_REL call = {
@@ -289,15 +327,17 @@ BOOL CreateTrampolineFunction(PTRAMPOLINE ct)
 
         // Avoid using memcpy to reduce the footprint.
 #ifndef _MSC_VER
-        memcpy((LPBYTE)ct->pTrampoline + newPos, pCopySrc, copySize);
+        memcpy((LPBYTE)WritableBuffer(ct->pTrampoline) + newPos, pCopySrc, copySize);
 #else
-        __movsb((LPBYTE)ct->pTrampoline + newPos, pCopySrc, copySize);
+        __movsb((LPBYTE)WritableBuffer(ct->pTrampoline) + newPos, pCopySrc, copySize);
 #endif
         newPos += copySize;
         oldPos += hs.len;
     }
     while (!finished);
 
+    ct->newSize = newPos;
+
     // Is there enough place for a long jump?
     if (oldPos < sizeof(JMP_REL)
         && !IsCodePadding((LPBYTE)ct->pTarget + oldPos, sizeof(JMP_REL) - oldPos))
@@ -319,5 +359,116 @@ BOOL CreateTrampolineFunction(PTRAMPOLINE ct)
         ct->patchAbove = TRUE;
     }
 
+    // The decoder may miss the end of the function, when known the patch
+    // must not overwrite the next one.
+    if (g_pFindFunctionEnd != NULL)
+    {
+        LPBYTE pEnd = (LPBYTE)g_pFindFunctionEnd(ct->pTarget);
+        LPBYTE pPatchEnd = (LPBYTE)ct->pTarget
+            + (ct->patchAbove ? sizeof(JMP_REL_SHORT) : sizeof(JMP_REL));
+        if (pEnd != NULL && pEnd > (LPBYTE)ct->pTarget && pPatchEnd > pEnd
+            && !IsCodePadding(pEnd, (UINT)(pPatchEnd - pEnd)))
+        {
+            return FALSE;
+        }
+    }
+
     return TRUE;
 }
+
+//-------------------------------------------------------------------------
+// Writes the unwind data of the trampoline after its code, translated from
+// the one of the target function: if hooked at its start, the unwind codes
+// of the prolog part copied, moved to the new instruction boundaries, if
+// hooked past its prolog, all of them. Exception handlers are dropped, they
+// rely on the image of the target. Returns its address, or NULL if the
+// trampoline is left a leaf function: the target has no unwind data, it is
+// hooked midway through its prolog, the data is chained or doesn't fit.
+// The jumps out of the trampoline carry a segment prefix, else the unwinder
+// would take them for the tail jump of an epilog and pop only the return
+// address, ignoring the copied pushes. A copied call through a register or
+// memory returns right onto the final jump, so it is no rare case.
+LPVOID CreateTrampolineUnwindInfo(PTRAMPOLINE ct)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    DWORD64 imageBase;
+    PRUNTIME_FUNCTION pFunction;
+    LPBYTE pOld;
+    LPBYTE pInfo;
+    LPBYTE pNew;
+    ULONG_PTR offset;
+    UINT room, count = 0, prolog = 0, frame = 0, i, j, slots;
+
+    pFunction = RtlLookupFunctionEntry((DWORD64)ct->pTarget, &imageBase, NULL);
+    if (pFunction == NULL)
+        return NULL;
+
+    // Entries may refer to the one they share the data with.
+    if (pFunction->UnwindData & 1)
+        pFunction = (PRUNTIME_FUNCTION)(imageBase + (pFunction->UnwindData & ~1));
+
+    // Version 1, the chained data is relative to the image.
+    pOld = (LPBYTE)imageBase + pFunction->UnwindData;
+    if ((pOld[0] & 0x07) != 1 || (pOld[0] & (UNW_FLAG_CHAININFO << 3)))
+        return NULL;
+
+    pInfo = (LPBYTE)(((ULONG_PTR)ct->pTrampoline + ct->newSize + 3) & ~(ULONG_PTR)3);
+    if (pInfo + 4 > (LPBYTE)ct->pTrampoline + ct->trampolineSize)
+        return NULL;
+    room = (UINT)((LPBYTE)ct->pTrampoline + ct->trampolineSize - pInfo - 4) / 2;
+    pNew = (LPBYTE)WritableBuffer(pInfo);
+
+    offset = (ULONG_PTR)ct->pTarget - (imageBase + pFunction->BeginAddress);
+    if (offset >= pOld[1])
+    {
+        count = pOld[2];
+        if (((count + 1) & ~1) > room)
+            return NULL;
+        memcpy(pNew + 4, pOld + 4, count * 2);
+        frame = pOld[3];
+    }
+    else if (offset == 0)
+    {
+        // Ordered by offset, the last operations of the prolog first.
+        for (i = 0; i < pOld[2]; i += slots)
+        {
+            LPBYTE pCode = pOld + 4 + i * 2;
+            slots = UnwindCodeSlots(pCode[1]);
+            if (slots == 0)
+                return NULL;
+
+            if (pCode[0] > ct->oldIPs[ct->nIP - 1])
+                continue;
+
+            for (j = 0; j < ct->nIP && ct->oldIPs[j] != pCode[0]; ++j);
+            if (j == ct->nIP || ((count + slots + 1) & ~1) > room)
+                return NULL;
+
+            memcpy(pNew + 4 + count * 2, pCode, slots * 2);
+            pNew[4 + count * 2] = ct->newIPs[j];
+            if (prolog < ct->newIPs[j])
+                prolog = ct->newIPs[j];
+            if ((pCode[1] & 0x0F) == 3)
+                frame = pOld[3];
+            count += slots;
+        }
+    }
+    else
+    {
+        return NULL;
+    }
+
+    // An even count of slots, keeping the info DWORD aligned.
+    if (count & 1)
+        pNew[4 + count * 2] = pNew[5 + count * 2] = 0;
+
+    pNew[0] = 1;
+    pNew[1] = (UINT8)prolog;
+    pNew[2] = (UINT8)count;
+    pNew[3] = (UINT8)frame;
+    return pInfo;
+#else
+    UNREFERENCED_PARAMETER(ct);
+    return NULL;
+#endif
+}
@@ -55,6 +55,17 @@ typedef struct _JMP_ABS
     UINT64 address;     // Absolute destination address
 } JMP_ABS, *PJMP_ABS;
 
+// 64-bit indirect absolute jump out of a trampoline. The x64 unwinder takes
+// a plain one for the tail jump of an epilog, as if the frame was popped.
+typedef struct _JMP_ABS_CS
+{
+    UINT8  prefix;      // 2E FF25 00000000: JMP CS:[+7]
+    UINT8  opcode0;
+    UINT8  opcode1;
+    UINT32 dummy;
+    UINT64 address;     // Absolute destination address
+} JMP_ABS_CS, *PJMP_ABS_CS;
+
 // 64-bit indirect absolute call.
 typedef struct _CALL_ABS
 {
@@ -77,11 +88,12 @@ typedef struct _JCC_REL
 // 64bit indirect absolute conditional jumps that x64 lacks.
 typedef struct _JCC_ABS
 {
-    UINT8  opcode;      // 7* 0E:         J** +16
+    UINT8  opcode;      // 7* 0F:            J** +17
     UINT8  dummy0;
-    UINT8  dummy1;      // FF25 00000000: JMP [+6]
+    UINT8  dummy1;      // 2E FF25 00000000: JMP CS:[+7]
     UINT8  dummy2;
-    UINT32 dummy3;
+    UINT8  dummy3;
+    UINT32 dummy4;
     UINT64 address;     // Absolute destination address
 } JCC_ABS;
 
@@ -105,7 +117,10 @@ typedef struct _TRAMPOLINE
     UINT   nIP;             // [Out] Number of the instruction boundaries.
     UINT8  oldIPs[8];       // [Out] Instruction boundaries of the target function.
     UINT8  newIPs[8];       // [Out] Instruction boundaries of the trampoline function.
+    UINT   newSize;         // [Out] Size of the trampoline function.
 } TRAMPOLINE, *PTRAMPOLINE;
 
 VOID CreateRelayFunction(PJMP_RELAY pJmpRelay, LPVOID pDetour);
 BOOL CreateTrampolineFunction(PTRAMPOLINE ct);
+LPVOID CreateTrampolineUnwindInfo(PTRAMPOLINE ct);
+VOID SetFunctionEndFinder(LPVOID (*pFind)(LPVOID));
@@ -36,22 +36,45 @@
 #define SSEH_ADDRLIB_HPP
 
 #include <cstdint>
+#include <array>
+#include <string_view>
 #include <vector>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
 #include <charconv>
 
+#include <xmmintrin.h>
+
 #include <utils/winutils.hpp>
 
 std::ofstream& log ();
 //--------------------------------------------------------------------------------------------------
 
+/// The default names, generated by the build from addrlib-names-default.txt into the build folder
+#include "addrlib-default.hpp"
+
+template<class Table>
+constexpr bool is_sorted_table (Table const& t)
+{
+    for (std::size_t i = 1; i < t.size (); ++i)
+        if (!(t[i-1].first < t[i].first))
+            return false;
+    return true;
+}
+
+static_assert (is_sorted_table (addrlib_defaults), "addrlib_defaults must be sorted and unique");
+
+//--------------------------------------------------------------------------------------------------
+
 class address_library
 {
     std::vector<std::pair<std::uint64_t, std::uint64_t>> data;
     std::vector<std::pair<std::string, std::uint64_t>> names;
 
+    /// Bytes of #names with the strings out of it, counted once on load
+    std::size_t names_memory = 0;
+
 	template<typename T>
 	static inline T read (std::ifstream& file)
 	{
@@ -70,6 +93,45 @@ class address_library
         return 0;
     }
 
+    template<typename C>
+    static void prefetch (C const& c, std::size_t i)
+    {
+        if (i < c.size ())
+            _mm_prefetch (reinterpret_cast<const char*> (&c[i]), _MM_HINT_T0);
+    }
+
+    /// Looks up the (key, index) queries, sorted by key, all together: each round takes every search
+    /// one level down the table, prefetching the two entries its next round may probe, so their
+    /// cache misses overlap rather than add up. Neighbouring queries share most of their probes. The
+    /// values found go to out[index], the rest are left as they are.
+    template<typename Q, typename C, typename T>
+    static void find_sorted (std::vector<Q> const& queries, C const& c, T* out)
+    {
+        if (queries.empty () || c.empty ())
+            return;
+
+        std::vector<std::size_t> lo (queries.size (), 0);
+        for (std::size_t n = c.size (); n > 1; )
+        {
+            auto half = n / 2;
+            n -= half;
+            for (std::size_t q = 0; q < queries.size (); ++q)
+            {
+                if (c[lo[q] + half].first < queries[q].first)
+                    lo[q] += half;
+                prefetch (c, lo[q] + n / 2);
+                prefetch (c, lo[q] + n - n / 2);
+            }
+        }
+
+        for (std::size_t q = 0; q < queries.size (); ++q)
+        {
+            auto i = lo[q] + (c[lo[q]].first < queries[q].first);
+            if (i < c.size () && c[i].first == queries[q].first)
+                out[queries[q].second] = c[i].second;
+        }
+    }
+
 public:
 
     std::uintptr_t find (std::uint64_t id) const {
@@ -83,13 +145,61 @@ public:
         return 0;
     }
 
-    std::uint64_t find_id (std::string const& name) const {
-        return find (name, names);
+    /// The names loaded from the disk override the compiled in defaults
+    std::uint64_t find_id (std::string const& name) const
+    {
+        if (auto id = find (name, names); id)
+            return id;
+        return find (std::string_view (name), addrlib_defaults);
+    }
+
+    /// Offsets of many ids at once, 0 for the unknown ones
+    void find (std::uint64_t const* ids, std::size_t n, std::uintptr_t* out) const
+    {
+        std::vector<std::pair<std::uint64_t, std::size_t>> queries;
+        queries.reserve (n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            out[i] = 0;
+            if (ids[i])
+                queries.emplace_back (ids[i], i);
+        }
+        std::sort (queries.begin (), queries.end ());
+        find_sorted (queries, data, out);
+    }
+
+    /// Ids of many names at once, 0 for the unknown ones, the loaded names override the defaults
+    void find_ids (std::string_view const* names, std::size_t n, std::uint64_t* ids) const
+    {
+        std::vector<std::pair<std::string_view, std::size_t>> queries;
+        queries.reserve (n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            ids[i] = 0;
+            queries.emplace_back (names[i], i);
+        }
+        std::sort (queries.begin (), queries.end ());
+        find_sorted (queries, this->names, ids);
+
+        queries.erase (std::remove_if (queries.begin (), queries.end (),
+                    [ids] (auto const& q) { return ids[q.second] != 0; }), queries.end ());
+        find_sorted (queries, addrlib_defaults, ids);
+    }
+
+    /// Bytes of the id to offset table
+    std::size_t ids_size () const {
+        return data.capacity () * sizeof (data[0]);
+    }
+
+    /// Bytes of the name to id table, including the strings
+    std::size_t names_size () const {
+        return names_memory;
     }
 
     bool load_txt ()
     {
         names.clear ();
+        names_memory = 0;
 
         std::string folder = "Data\\SKSE\\Plugins\\sse-hooks\\";
         std::vector<std::string> filenames;
@@ -116,6 +226,11 @@ public:
 
         std::sort (names.begin (), names.end ());
         names.erase (std::unique (names.begin (), names.end ()), names.end ());
+
+        names_memory = names.capacity () * sizeof (names[0]);
+        for (auto const& n: names)
+            if (n.first.capacity () > std::string ().capacity ())
+                names_memory += n.first.capacity () + 1;
         return true;
     }
 
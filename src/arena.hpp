@@ -0,0 +1,175 @@
+/**
+ * @file arena.hpp
+ * @brief Pooled arena allocator backing the JSON registry
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * The registry DOM consists of many small nodes (map nodes, JSON values, vectors of few elements).
+ * Instead of leaving them scattered as individual heap blocks, they are carved out of large blocks
+ * and recycled through per size class free lists. An arena is dropped as a whole, hence a
+ * replaced registry does not need to give back its memory node by node.
+ *
+ * The nlohmann library instantiates its allocators by default construction, so the allocator is
+ * stateless and routes through #pool_arena::current instead.
+ */
+
+#ifndef SSEH_ARENA_HPP
+#define SSEH_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <new>
+
+//--------------------------------------------------------------------------------------------------
+
+class pool_arena
+{
+    /// Each new chunk of memory requested from the system
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    /// Size classes step, also the guaranteed alignment
+    static constexpr std::size_t granularity = 16;
+
+    /// Anything bigger goes directly to the global heap
+    static constexpr std::size_t max_pooled = 256;
+
+    struct free_node { free_node* next; };
+
+    std::vector<char*> blocks;
+    std::array<free_node*, max_pooled / granularity> free_lists = {};
+    char* head = nullptr;
+    std::size_t left = 0;
+    std::size_t in_use = 0;
+
+    static constexpr std::size_t size_class (std::size_t n) {
+        return (n + granularity - 1) / granularity - 1;
+    }
+
+public:
+
+    /// Where all #arena_allocator instances take and return memory, nullptr means global heap
+    static inline pool_arena* current = nullptr;
+
+    pool_arena () = default;
+    pool_arena (pool_arena const&) = delete;
+    pool_arena& operator = (pool_arena const&) = delete;
+    ~pool_arena () { release (); }
+
+    void* allocate (std::size_t n)
+    {
+        if (!n || n > max_pooled)
+            return ::operator new (n);
+
+        auto c = size_class (n);
+        in_use += (c + 1) * granularity;
+        if (auto p = free_lists[c])
+        {
+            free_lists[c] = p->next;
+            return p;
+        }
+
+        n = (c + 1) * granularity;
+        if (left < n)
+        {
+            blocks.push_back (static_cast<char*> (::operator new (block_size)));
+            head = blocks.back ();
+            left = block_size;
+        }
+        auto p = head;
+        head += n;
+        left -= n;
+        return p;
+    }
+
+    void deallocate (void* p, std::size_t n) noexcept
+    {
+        if (!n || n > max_pooled)
+        {
+            ::operator delete (p);
+            return;
+        }
+        auto c = size_class (n);
+        in_use -= (c + 1) * granularity;
+        auto node = static_cast<free_node*> (p);
+        node->next = free_lists[c];
+        free_lists[c] = node;
+    }
+
+    /// Drop all the memory at once, outstanding pointers are invalidated
+    void release () noexcept
+    {
+        for (auto b: blocks)
+            ::operator delete (b);
+        blocks.clear ();
+        free_lists.fill (nullptr);
+        head = nullptr;
+        left = in_use = 0;
+    }
+
+    /// Bytes requested from the system
+    std::size_t reserved () const { return blocks.size () * block_size; }
+
+    /// Bytes handed out to the users, rounded up to the size classes
+    std::size_t used () const { return in_use; }
+};
+
+//--------------------------------------------------------------------------------------------------
+
+/// Stateless adaptor to #pool_arena::current, suitable for nlohmann::basic_json
+
+template<class T>
+struct arena_allocator
+{
+    typedef T value_type;
+
+    arena_allocator () noexcept = default;
+    template<class U> arena_allocator (arena_allocator<U> const&) noexcept {}
+
+    T* allocate (std::size_t n)
+    {
+        static_assert (alignof (T) <= 16, "Pool arena guarantees only 16 bytes alignment");
+        auto bytes = n * sizeof (T);
+        if (auto a = pool_arena::current)
+            return static_cast<T*> (a->allocate (bytes));
+        return static_cast<T*> (::operator new (bytes));
+    }
+
+    void deallocate (T* p, std::size_t n) noexcept
+    {
+        if (auto a = pool_arena::current)
+            a->deallocate (p, n * sizeof (T));
+        else
+            ::operator delete (p);
+    }
+};
+
+template<class T, class U> inline
+bool operator == (arena_allocator<T> const&, arena_allocator<U> const&) { return true; }
+
+template<class T, class U> inline
+bool operator != (arena_allocator<T> const&, arena_allocator<U> const&) { return false; }
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_ARENA_HPP
@@ -0,0 +1,154 @@
+/**
+ * @file cache.cpp
+ * @copybrief cache.hpp
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ */
+
+#include "cache.hpp"
+
+#include <utils/winutils.hpp>
+
+#include <cstring>
+#include <fstream>
+
+//--------------------------------------------------------------------------------------------------
+
+/// Folder of the indexes on disk, named by the module hashes
+static const char* cache_folder = "Data\\SKSE\\Plugins\\sse-hooks\\cache\\";
+
+static constexpr std::uint64_t cache_magic = 0x31304348'48455353ull; // "SSEHCH01"
+
+//--------------------------------------------------------------------------------------------------
+
+/// The NT headers and the section table, as mapped from the file
+
+static std::pair<const std::uint8_t*, const std::uint8_t*>
+headers (module_info const& m)
+{
+    auto dos = reinterpret_cast<const IMAGE_DOS_HEADER*> (m.base);
+    auto nt = reinterpret_cast<const IMAGE_NT_HEADERS*> (m.base + dos->e_lfanew);
+    return { reinterpret_cast<const std::uint8_t*> (nt),
+             reinterpret_cast<const std::uint8_t*> (IMAGE_FIRST_SECTION (nt)
+                     + nt->FileHeader.NumberOfSections) };
+}
+
+//--------------------------------------------------------------------------------------------------
+
+std::uint64_t
+module_hash (module_info const& m)
+{
+    auto [p, end] = headers (m);
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    for (; p != end; ++p)
+        h = (h ^ *p) * 0x100000001b3ull;
+    return h;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+bool
+read_image (module_info const& m, std::string& bytes)
+{
+    std::wstring path (MAX_PATH, L'\0');
+    DWORD n;
+    while ((n = ::GetModuleFileNameW (m.handle, &path[0], DWORD (path.size ()))) == path.size ())
+        path.resize (path.size () * 2);
+    if (!n)
+        return false;
+    path.resize (n);
+
+    auto file = ::CreateFileW (path.c_str (), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    DWORD read = 0;
+    bool ok = ::GetFileSizeEx (file, &size) && size.QuadPart > 0 && size.QuadPart < 0x7fffffff;
+    if (ok)
+    {
+        bytes.resize (std::size_t (size.QuadPart));
+        ok = ::ReadFile (file, &bytes[0], DWORD (bytes.size ()), &read, nullptr)
+            && read == bytes.size ();
+    }
+    ::CloseHandle (file);
+
+    // The headers are mapped as they are in the file, a replaced file shows here
+    auto [begin, end] = headers (m);
+    auto offset = std::size_t (begin - reinterpret_cast<const std::uint8_t*> (m.base));
+    if (!ok || bytes.size () < offset + (end - begin)
+            || std::memcmp (bytes.data () + offset, begin, end - begin))
+    {
+        bytes.clear ();
+        return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static std::string
+cache_path (std::uint64_t hash, const char* kind)
+{
+    return cache_folder + hex_string (hash, false).substr (2) + "." + kind;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+bool
+read_cache (std::uint64_t hash, const char* kind, std::string& bytes)
+{
+    std::ifstream fi (cache_path (hash, kind), std::ios::binary);
+    std::uint64_t header[3];
+    if (!fi.read (reinterpret_cast<char*> (header), sizeof (header))
+            || header[0] != cache_magic || header[1] != hash)
+        return false;
+
+    // A truncated file is rebuilt rather than trusted
+    fi.seekg (0, std::ios::end);
+    if (header[2] > std::uint64_t (fi.tellg ()) - sizeof (header))
+        return false;
+    fi.seekg (sizeof (header));
+    bytes.resize (header[2]);
+    if (fi.read (&bytes[0], bytes.size ()))
+        return true;
+    bytes.clear ();
+    return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+write_cache (std::uint64_t hash, const char* kind, const void* data, std::size_t size)
+{
+    // Each level in turn, the existing ones simply fail
+    std::string folder (cache_folder);
+    for (auto i = folder.find ('\\'); i != std::string::npos; i = folder.find ('\\', i + 1))
+        ::CreateDirectoryA (folder.substr (0, i).c_str (), nullptr);
+
+    std::ofstream fo (cache_path (hash, kind), std::ios::binary | std::ios::trunc);
+    std::uint64_t header[3] = { cache_magic, hash, size };
+    fo.write (reinterpret_cast<const char*> (header), sizeof (header));
+    fo.write (static_cast<const char*> (data), size);
+}
+
+//--------------------------------------------------------------------------------------------------
+
@@ -0,0 +1,156 @@
+/**
+ * @file cache.hpp
+ * @brief Indexes of the modules stored on disk, between the game runs
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * Each file is named by the hash of the module headers and by the kind of the index, and holds
+ * raw bytes as laid out by its user. A different game build has a different hash, so stale files
+ * are never read, only left behind.
+ *
+ * The indexes are built on first use by splitting the sections among the hardware threads, each
+ * of which takes a slice and keeps what starts inside it.
+ */
+
+#ifndef SSEH_CACHE_HPP
+#define SSEH_CACHE_HPP
+
+#include "modules.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+
+/// FNV-1a of the PE headers, which differ with each build of the module
+std::uint64_t module_hash (module_info const& m);
+
+/// The image file the module was loaded from, false if it can't be read or its headers differ
+bool read_image (module_info const& m, std::string& bytes);
+
+/// The bytes stored for the hash, false if there are none or they are damaged
+bool read_cache (std::uint64_t hash, const char* kind, std::string& bytes);
+
+/// Best effort, a failure only costs rebuilding the index on the next run
+void write_cache (std::uint64_t hash, const char* kind, const void* data, std::size_t size);
+
+//--------------------------------------------------------------------------------------------------
+
+/**
+ * Reads the index back from the cache, else builds and stores it.
+ *
+ * @param load the index from the stored bytes, false if they do not fit
+ * @param build the index, false if it is not to be kept for the next runs
+ * @param save the built index into bytes
+ */
+
+template<class Load, class Build, class Save>
+void
+load_or_build (std::uint64_t hash, const char* kind, Load&& load, Build&& build, Save&& save)
+{
+    std::string bytes;
+    if (read_cache (hash, kind, bytes) && load (bytes))
+        return;
+    if (build ())
+    {
+        bytes = save ();
+        write_cache (hash, kind, bytes.data (), bytes.size ());
+    }
+}
+
+/// As above, for the records stored as they are laid out in memory
+template<class T, class Build>
+void
+load_or_build (std::uint64_t hash, const char* kind, std::vector<T>& items, Build&& build)
+{
+    load_or_build (hash, kind,
+        [&items] (std::string const& bytes) {
+            if (bytes.size () % sizeof (T))
+                return false;
+            items.resize (bytes.size () / sizeof (T));
+            std::memcpy (items.data (), bytes.data (), bytes.size ());
+            return true;
+        },
+        [&items, &build] {
+            items.clear ();
+            return build (items);
+        },
+        [&items] {
+            return std::string (reinterpret_cast<const char*> (items.data ()),
+                                items.size () * sizeof (T));
+        });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/**
+ * Runs the scan over the ranges of the given sizes, split in slices among the hardware threads.
+ *
+ * @param sizes of the ranges, a range is split only if larger than the minimal slice
+ * @param scan taking the range index, the slice [begin, end) in it and the output vector
+ * @param less to sort the results of all slices with
+ * @param[out] out the sorted results
+ */
+
+template<class T, class Scan, class Less>
+void
+scan_slices (std::vector<std::size_t> const& sizes, Scan&& scan, Less&& less, std::vector<T>& out)
+{
+    struct slice { std::size_t range, begin, end; };
+    std::vector<slice> slices;
+
+    std::size_t total = 0;
+    for (auto n: sizes)
+        total += n;
+
+    std::size_t threads = std::max (1u, std::thread::hardware_concurrency ());
+    std::size_t step = std::max<std::size_t> (total / threads + 1, 0x10000);
+    for (std::size_t r = 0; r < sizes.size (); ++r)
+        for (std::size_t b = 0; b < sizes[r]; b += step)
+            slices.push_back (slice { r, b, std::min (sizes[r], b + step) });
+
+    std::vector<std::vector<T>> found (slices.size ());
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < slices.size (); ++i)
+        workers.emplace_back ([&scan, &s = slices[i], &f = found[i]] {
+            scan (s.range, s.begin, s.end, f);
+        });
+    for (auto& w: workers)
+        w.join ();
+
+    std::size_t n = 0;
+    for (auto const& f: found)
+        n += f.size ();
+    out.reserve (out.size () + n);
+    for (auto const& f: found)
+        out.insert (out.end (), f.begin (), f.end ());
+    std::sort (out.begin (), out.end (), less);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_CACHE_HPP
+
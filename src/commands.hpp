@@ -0,0 +1,46 @@
+/**
+ * @file commands.hpp
+ * @brief Registry of the commands run by sseh_execute()
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * Any part of SSEH can make itself reachable through the sseh_execute() entry, which every client
+ * already has in its interface table, without touching the table itself. Commands are looked up by
+ * name in a hash table.
+ */
+
+#ifndef SSEH_COMMANDS_HPP
+#define SSEH_COMMANDS_HPP
+
+#include <string>
+
+//--------------------------------------------------------------------------------------------------
+
+/// Runs with the argument given to sseh_execute(), on failure returns false and sets the error
+typedef bool (*sseh_command) (void* arg, std::string& error);
+
+/// Adds, or replaces, the command with given name
+void register_command (std::string const& name, sseh_command command);
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_COMMANDS_HPP
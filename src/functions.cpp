@@ -0,0 +1,154 @@
+/**
+ * @file functions.cpp
+ * @copybrief functions.hpp
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ */
+
+#include "functions.hpp"
+#include "cache.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+//--------------------------------------------------------------------------------------------------
+
+/// UNWIND_INFO flag of the parts, their entry is followed by the one of the function they belong to
+static constexpr std::uint8_t unwind_chain_info = 4;
+
+/// Deeper chains are taken as broken data
+static constexpr int max_chain = 32;
+
+static std::unordered_map<std::uintptr_t, function_table> tables;
+
+//--------------------------------------------------------------------------------------------------
+
+function_range const*
+function_table::find (std::uint32_t rva) const
+{
+    auto it = std::upper_bound (ranges.begin (), ranges.end (), rva,
+            [] (std::uint32_t rva, function_range const& r) { return rva < r.begin; });
+    if (it == ranges.begin () || rva >= (--it)->end)
+        return nullptr;
+    return &*it;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The function a range belongs to, following the chain of its unwind data
+
+static std::uint32_t
+entry_of (std::uintptr_t base, std::size_t size, RUNTIME_FUNCTION const& f)
+{
+    auto rf = &f;
+    for (int depth = 0; depth < max_chain; ++depth)
+    {
+        // Version and flags, prolog size, count of the codes and frame register
+        auto unwind = rf->UnwindData & ~1u;
+        if (unwind == 0 || unwind > size - 4)
+            break;
+        auto info = reinterpret_cast<const std::uint8_t*> (base + unwind);
+        if (!((info[0] >> 3) & unwind_chain_info))
+            break;
+
+        // The codes array is padded to an even count
+        std::size_t chained = unwind + 4 + ((info[2] + 1u) & ~1u) * 2;
+        if (chained > size - sizeof (RUNTIME_FUNCTION))
+            break;
+        rf = reinterpret_cast<const RUNTIME_FUNCTION*> (base + chained);
+    }
+    return std::uint32_t (rf->BeginAddress);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+parse_functions (std::uintptr_t base, std::size_t size, std::vector<function_range>& ranges)
+{
+    auto dos = reinterpret_cast<const IMAGE_DOS_HEADER*> (base);
+    auto nt = reinterpret_cast<const IMAGE_NT_HEADERS*> (base + dos->e_lfanew);
+    if (nt->OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_EXCEPTION)
+        return;
+    auto const& dir = nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+    if (!dir.VirtualAddress || dir.VirtualAddress > size || dir.Size > size - dir.VirtualAddress)
+        return;
+
+    auto first = reinterpret_cast<const RUNTIME_FUNCTION*> (base + dir.VirtualAddress);
+    auto last = first + dir.Size / sizeof (RUNTIME_FUNCTION);
+    ranges.reserve (last - first);
+    for (auto f = first; f != last; ++f)
+        if (f->BeginAddress < f->EndAddress && f->EndAddress <= size)
+            ranges.push_back (function_range { std::uint32_t (f->BeginAddress),
+                    std::uint32_t (f->EndAddress), entry_of (base, size, *f) });
+
+    // The linker sorts them already, unless the image is odd
+    if (!std::is_sorted (ranges.begin (), ranges.end (),
+                [] (auto const& a, auto const& b) { return a.begin < b.begin; }))
+        std::sort (ranges.begin (), ranges.end (),
+                [] (auto const& a, auto const& b) { return a.begin < b.begin; });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+function_table const&
+find_functions (module_info const& m)
+{
+    if (!m.size)
+        throw std::runtime_error ("not a PE image");
+
+    auto hash = module_hash (m);
+    auto& t = tables[m.base];
+    if (t.hash != hash)
+    {
+        t.hash = hash;
+        t.ranges.clear ();
+        parse_functions (m.base, m.size, t.ranges);
+    }
+    return t;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+function_range const*
+find_parsed_function (std::uintptr_t address, std::uintptr_t* base)
+{
+    // The ranges lie within their images, which do not overlap
+    for (auto const& t: tables)
+        if (address >= t.first && address - t.first <= UINT32_MAX)
+            if (auto f = t.second.find (std::uint32_t (address - t.first)))
+            {
+                *base = t.first;
+                return f;
+            }
+    return nullptr;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+clear_functions ()
+{
+    tables.clear ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
@@ -0,0 +1,72 @@
+/**
+ * @file functions.hpp
+ * @brief Function boundaries of a module, as described by its exception directory
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * Each x64 function, apart from the leaf ones which touch neither the stack nor the non-volatile
+ * registers, has an entry in .pdata for the unwinder. Its parts moved away by the compiler have
+ * entries of their own, chained to the one of the function itself. Only the image in memory is
+ * read, so this works on any platform given a mapped PE file.
+ */
+
+#ifndef SSEH_FUNCTIONS_HPP
+#define SSEH_FUNCTIONS_HPP
+
+#include "modules.hpp"
+
+#include <cstdint>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+
+/// Relative to the module base, the entry is the start of the function owning a chained part
+struct function_range
+{
+    std::uint32_t begin, end, entry;
+};
+
+struct function_table
+{
+    std::uint64_t hash;                     ///< Of the module headers
+    std::vector<function_range> ranges;     ///< Ordered by their beginnings
+
+    /// The range holding the RVA, null if it is in none
+    function_range const* find (std::uint32_t rva) const;
+};
+
+/// Parses the table of the module on first use, empty if there is no exception directory
+function_table const& find_functions (module_info const& m);
+
+/// The range holding the address in the tables parsed already, null if in none. Allocates nothing.
+function_range const* find_parsed_function (std::uintptr_t address, std::uintptr_t* base);
+
+/// The ranges of a PE image mapped at the given address, for #find_functions()
+void parse_functions (std::uintptr_t base, std::size_t size, std::vector<function_range>& ranges);
+
+/// Drops the tables in memory
+void clear_functions ();
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_FUNCTIONS_HPP
+
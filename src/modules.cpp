@@ -0,0 +1,216 @@
+/**
+ * @file modules.cpp
+ * @copybrief modules.hpp
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * The unload notifications come from LdrRegisterDllNotification(), on whatever thread unloads and
+ * under the loader lock, so the callback only bumps a counter which the next lookup compares.
+ * Without the notifications (e.g. the function is missing) each lookup asks for the handle again,
+ * and an entry is kept only as long as it stays the same.
+ */
+
+#include "modules.hpp"
+
+#include <utils/winutils.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <unordered_map>
+
+//--------------------------------------------------------------------------------------------------
+
+/// Only the base is of interest, the rest of the notification data is left opaque
+struct dll_notification_data
+{
+    ULONG flags;
+    const void* full_name;
+    const void* base_name;
+    PVOID base;
+    ULONG size;
+};
+
+typedef VOID (NTAPI* dll_notification) (ULONG, dll_notification_data const*, PVOID);
+typedef LONG (NTAPI* ldr_register) (ULONG, dll_notification, PVOID, PVOID*);
+typedef LONG (NTAPI* ldr_unregister) (PVOID);
+
+static constexpr ULONG dll_unloaded = 2;
+
+static std::unordered_map<std::string, module_ref> modules;
+
+/// Bumped on each unload, #modules are valid as long as it equals #modules_unloads
+static std::atomic<unsigned> unloads { 0 };
+static unsigned modules_unloads = 0;
+
+/// Registration cookie, null when not listening
+static PVOID listening = nullptr;
+
+//--------------------------------------------------------------------------------------------------
+
+static VOID NTAPI
+on_dll_notification (ULONG reason, dll_notification_data const*, PVOID)
+{
+    if (reason == dll_unloaded)
+        unloads.fetch_add (1, std::memory_order_release);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+listen_unloads ()
+{
+    if (listening)
+        return true;
+    auto ntdll = ::GetModuleHandle (L"ntdll.dll");
+    if (!ntdll)
+        return false;
+    auto reg = reinterpret_cast<ldr_register> (
+            ::GetProcAddress (ntdll, "LdrRegisterDllNotification"));
+    if (!reg || reg (0, on_dll_notification, nullptr, &listening) != 0)
+    {
+        listening = nullptr;
+        return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static void
+read_sections (module_info& m)
+{
+    auto dos = reinterpret_cast<const IMAGE_DOS_HEADER*> (m.base);
+    if (dos->e_magic != IMAGE_DOS_SIGNATURE)
+        return;
+    auto nt = reinterpret_cast<const IMAGE_NT_HEADERS*> (m.base + dos->e_lfanew);
+    if (nt->Signature != IMAGE_NT_SIGNATURE)
+        return;
+
+    m.size = nt->OptionalHeader.SizeOfImage;
+    auto s = IMAGE_FIRST_SECTION (nt);
+    m.sections.reserve (nt->FileHeader.NumberOfSections);
+    for (WORD i = 0; i < nt->FileHeader.NumberOfSections; ++i, ++s)
+    {
+        module_section ms = {};
+        std::memcpy (ms.name, s->Name, IMAGE_SIZEOF_SHORT_NAME);
+        ms.begin = m.base + s->VirtualAddress;
+        ms.end = ms.begin + s->Misc.VirtualSize;
+        ms.characteristics = s->Characteristics;
+        ms.file_offset = s->PointerToRawData;
+        ms.file_size = s->SizeOfRawData;
+        m.sections.push_back (ms);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+
+module_ref
+find_module (std::string const& name)
+{
+    std::string key (name);
+    for (auto& c: key)
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+
+    bool listened = listen_unloads ();
+    if (listened)
+    {
+        if (auto u = unloads.load (std::memory_order_acquire); u != modules_unloads)
+        {
+            modules.clear ();
+            modules_unloads = u;
+        }
+        if (auto it = modules.find (key); it != modules.end ())
+            return it->second;
+    }
+
+    std::wstring wm;
+    if (!utf8_to_utf16 (name.c_str (), wm))
+        return nullptr;
+    auto h = ::GetModuleHandle (wm.empty () ? nullptr : wm.c_str ());
+    if (!h)
+    {
+        modules.erase (key);
+        return nullptr;
+    }
+    auto& cached = modules[key];
+    if (cached && cached->handle == h)
+        return cached;
+
+    auto m = std::make_shared<module_info> ();
+    m->handle = h;
+    m->base = reinterpret_cast<std::uintptr_t> (h);
+    read_sections (*m);
+    return cached = std::move (m);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+module_ref
+find_module_of (std::uintptr_t address)
+{
+    if (listening && unloads.load (std::memory_order_acquire) == modules_unloads)
+        for (auto const& m: modules)
+            if (m.second->contains (address))
+                return m.second;
+
+    HMODULE h;
+    if (!::GetModuleHandleExW (GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS
+                | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                reinterpret_cast<LPCWSTR> (address), &h))
+        return nullptr;
+
+    std::wstring path (MAX_PATH, L'\0');
+    path.resize (::GetModuleFileNameW (h, &path[0], DWORD (path.size ())));
+    std::string name;
+    if (path.empty () || !utf16_to_utf8 (path.substr (path.find_last_of (L"\\/") + 1).c_str (), name))
+        return nullptr;
+
+    auto m = find_module (name);
+    return m && m->contains (address) ? m : nullptr;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+ignore_unloads ()
+{
+    if (!listening)
+        return;
+    if (auto ntdll = ::GetModuleHandle (L"ntdll.dll"))
+        if (auto unreg = reinterpret_cast<ldr_unregister> (
+                    ::GetProcAddress (ntdll, "LdrUnregisterDllNotification")))
+            unreg (listening);
+    listening = nullptr;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+clear_modules ()
+{
+    modules.clear ();
+    ignore_unloads ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
@@ -0,0 +1,87 @@
+/**
+ * @file modules.hpp
+ * @brief Cache of the loaded modules, looked up by their names
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * The `Name@module` targets keep naming the same few modules, so each one is resolved and its
+ * headers are read only once. Any module unloading drops the whole cache, as told by the loader.
+ * Whatever needs to walk a module image (exports, code sections) gets it from here, as the function
+ * tables, the references, the string literals and the virtual tables do.
+ */
+
+#ifndef SSEH_MODULES_HPP
+#define SSEH_MODULES_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+//--------------------------------------------------------------------------------------------------
+
+struct module_section
+{
+    char name[IMAGE_SIZEOF_SHORT_NAME + 1];
+    std::uintptr_t begin, end;
+    DWORD characteristics;
+    std::uint32_t file_offset, file_size;   ///< Of the raw data in the image file
+
+    /// Readable, but not code, the constants and the tables of the compiler are there
+    bool is_data () const {
+        return (characteristics & IMAGE_SCN_MEM_READ) && !(characteristics & IMAGE_SCN_MEM_EXECUTE);
+    }
+};
+
+struct module_info
+{
+    HMODULE handle;
+    std::uintptr_t base;
+    std::size_t size;
+    std::vector<module_section> sections;
+
+    bool contains (std::uintptr_t a) const {
+        return a >= base && a < base + size;
+    }
+};
+
+/// Shared with the cache, so a dropped entry lives on while somebody still holds it
+typedef std::shared_ptr<const module_info> module_ref;
+
+/// UTF-8 name as for #GetModuleHandle(), empty for the game itself. Null if not loaded.
+module_ref find_module (std::string const& name);
+
+/// The module holding the address, through the same cache. Null if none does.
+module_ref find_module_of (std::uintptr_t address);
+
+/// Drops the cache and stops listening for the unloads
+void clear_modules ();
+
+/// Stops listening for the unloads only, safe under the loader lock
+void ignore_unloads ();
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_MODULES_HPP
+
@@ -0,0 +1,472 @@
+/**
+ * @file recorder.cpp
+ * @brief Implements the optional recording of the SSEH interface calls
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * Each wrapper forwards to the interface given to #record_api() and times only that call, so the
+ * cost of formatting and writing the line is not part of the recorded durations.
+ */
+
+#include "recorder.hpp"
+
+#include <utils/winutils.hpp>
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+//--------------------------------------------------------------------------------------------------
+
+/// The interface which does the actual work
+static sseh_api real = {};
+
+static std::ofstream record_file;
+static std::mutex record_mutex;
+static std::chrono::steady_clock::time_point record_start;
+
+/// From #record_open() to #record_close(), the wrappers only forward outside of it
+static std::atomic<bool> record_on { false };
+
+//--------------------------------------------------------------------------------------------------
+
+static nlohmann::json
+string_arg (const char* s)
+{
+    return s ? nlohmann::json (s) : nlohmann::json ();
+}
+
+/// Output buffers are described only by how much space the caller said they have
+
+static nlohmann::json
+buffer_arg (const std::size_t* size, const void* buffer)
+{
+    return size && buffer ? nlohmann::json (*size) : nlohmann::json ();
+}
+
+static nlohmann::json
+bytes_arg (const void* data, std::size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string s;
+    if (data)
+    {
+        s.reserve (size * 2);
+        for (auto p = static_cast<const unsigned char*> (data), e = p + size; p != e; ++p)
+            s.append ({ digits[*p >> 4], digits[*p & 15] });
+    }
+    return s;
+}
+
+/// The argument of sseh_execute () as its command takes it. Those of the commands not known here
+/// are marked as opaque, such calls can't be replayed.
+
+static nlohmann::json
+execute_arg (const char* command, void* arg)
+{
+    if (!arg)
+        return nullptr;
+    auto is = [command] (const char* c) { return command && !std::strcmp (command, c); };
+    if (is ("snapshot-save"))
+        return string_arg (static_cast<const char*> (arg));
+    if (is ("memory"))
+        return nlohmann::json::object ({ { "size", static_cast<sseh_memory*> (arg)->size } });
+    if (is ("stats") || is ("benchmark") || is ("verify") || is ("relayout") || is ("vtables"))
+    {
+        auto t = static_cast<sseh_text*> (arg);
+        return nlohmann::json::object ({ { "text", buffer_arg (&t->size, t->text) } });
+    }
+    return nlohmann::json::object ({ { "opaque", hex_string (arg) } });
+}
+
+/// Always an array, nlohmann::json would make an object out of some initializer lists
+
+template<class... Args>
+static nlohmann::json
+arguments (Args&&... args)
+{
+    return nlohmann::json::array ({ nlohmann::json (std::forward<Args> (args))... });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Times the call and writes down the line for it, with what it gave out if not null.
+/// The arguments are taken through a function, so that nothing is made once the recording is over.
+
+template<class Args, class Function, class Outputs>
+static auto
+record (const char* function, Args&& args, Function&& func, Outputs&& outputs)
+{
+    if (!record_on.load (std::memory_order_acquire))
+        return func ();
+
+    // Before the call, which may change the sizes of the output buffers
+    auto a = args ();
+
+    using namespace std::chrono;
+    auto t = steady_clock::now ();
+    auto r = func ();
+    auto d = steady_clock::now () - t;
+
+    nlohmann::json line = {
+        { "t", duration_cast<microseconds> (t - record_start).count () },
+        { "d", duration_cast<nanoseconds> (d).count () },
+        { "f", function },
+        { "a", std::move (a) },
+        { "r", r }
+    };
+    if (auto o = outputs (r); !o.is_null ())
+        line["o"] = std::move (o);
+    std::lock_guard<std::mutex> lock (record_mutex);
+    if (record_file.is_open ())
+        record_file << line.dump () << '\n';
+    return r;
+}
+
+template<class Args, class Function>
+static auto
+record (const char* function, Args&& args, Function&& func)
+{
+    return record (function, std::forward<Args> (args), std::forward<Function> (func),
+                   [] (auto) { return nlohmann::json (); });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static void SSEH_CCONV
+record_version (int* api, int* maj, int* imp, const char** build)
+{
+    record ("version", [] { return arguments (); }, [&] {
+        real.version (api, maj, imp, build);
+        return 0;
+    });
+}
+
+static void SSEH_CCONV
+record_last_error (size_t* size, char* message)
+{
+    record ("last_error", [&] { return arguments (buffer_arg (size, message)); }, [&] {
+        real.last_error (size, message);
+        return 0;
+    });
+}
+
+static int SSEH_CCONV
+record_init ()
+{
+    return record ("init", [] { return arguments (); }, [&] { return real.init (); });
+}
+
+static void SSEH_CCONV
+record_uninit ()
+{
+    record ("uninit", [] { return arguments (); }, [&] {
+        real.uninit ();
+        return 0;
+    });
+}
+
+static int SSEH_CCONV
+record_profile (const char* profile)
+{
+    return record ("profile", [&] { return arguments (string_arg (profile)); }, [&] {
+        return real.profile (profile);
+    });
+}
+
+static int SSEH_CCONV
+record_find_address (const char* module, const char* name, void** address)
+{
+    auto args = [&] { return arguments (string_arg (module), string_arg (name)); };
+    return record ("find_address", args, [&] {
+        return real.find_address (module, name, address);
+    });
+}
+
+static int SSEH_CCONV
+record_load (const char* filepath)
+{
+    return record ("load", [&] { return arguments (string_arg (filepath)); }, [&] {
+        return real.load (filepath);
+    });
+}
+
+static int SSEH_CCONV
+record_map_name (const char* name, uintptr_t address)
+{
+    auto args = [&] { return arguments (string_arg (name), hex_string (address)); };
+    return record ("map_name", args, [&] {
+        return real.map_name (name, address);
+    });
+}
+
+static int SSEH_CCONV
+record_find_target (const char* name, uintptr_t* target)
+{
+    return record ("find_target", [&] { return arguments (string_arg (name)); }, [&] {
+        return real.find_target (name, target);
+    }, [&] (int r) {
+        return r && target ? nlohmann::json (hex_string (*target)) : nlohmann::json ();
+    });
+}
+
+static int SSEH_CCONV
+record_find_name (uintptr_t target, size_t* size, char* name)
+{
+    auto args = [&] { return arguments (hex_string (target), buffer_arg (size, name)); };
+    return record ("find_name", args, [&] {
+        return real.find_name (target, size, name);
+    });
+}
+
+static int SSEH_CCONV
+record_detour (const char* name, void* detour, void** original)
+{
+    auto args = [&] { return arguments (string_arg (name), hex_string (detour)); };
+    return record ("detour", args, [&] {
+        return real.detour (name, detour, original);
+    });
+}
+
+static int SSEH_CCONV
+record_enable (const char* name)
+{
+    return record ("enable", [&] { return arguments (string_arg (name)); }, [&] {
+        return real.enable (name);
+    });
+}
+
+static int SSEH_CCONV
+record_disable (const char* name)
+{
+    return record ("disable", [&] { return arguments (string_arg (name)); }, [&] {
+        return real.disable (name);
+    });
+}
+
+static int SSEH_CCONV
+record_enable_all ()
+{
+    return record ("enable_all", [] { return arguments (); }, [&] { return real.enable_all (); });
+}
+
+static int SSEH_CCONV
+record_disable_all ()
+{
+    return record ("disable_all", [] { return arguments (); }, [&] { return real.disable_all (); });
+}
+
+static int SSEH_CCONV
+record_apply ()
+{
+    return record ("apply", [] { return arguments (); }, [&] { return real.apply (); });
+}
+
+static int SSEH_CCONV
+record_identify (const char* pointer, size_t* size, char* json)
+{
+    auto args = [&] { return arguments (string_arg (pointer), buffer_arg (size, json)); };
+    return record ("identify", args, [&] {
+        return real.identify (pointer, size, json);
+    });
+}
+
+static int SSEH_CCONV
+record_merge_patch (const char* json)
+{
+    return record ("merge_patch", [&] { return arguments (string_arg (json)); }, [&] {
+        return real.merge_patch (json);
+    });
+}
+
+static int SSEH_CCONV
+record_execute (const char* command, void* arg)
+{
+    auto args = [&] { return arguments (string_arg (command), execute_arg (command, arg)); };
+    return record ("execute", args, [&] {
+        return real.execute (command, arg);
+    });
+}
+
+static int SSEH_CCONV
+record_identify_as (const char* pointer, int format, size_t* size, void* data)
+{
+    auto args = [&] { return arguments (string_arg (pointer), format, buffer_arg (size, data)); };
+    return record ("identify_as", args, [&] {
+        return real.identify_as (pointer, format, size, data);
+    });
+}
+
+static int SSEH_CCONV
+record_merge_patch_as (int format, const void* data, size_t size)
+{
+    auto args = [&] { return arguments (format, bytes_arg (data, size)); };
+    return record ("merge_patch_as", args, [&] {
+        return real.merge_patch_as (format, data, size);
+    });
+}
+
+static int SSEH_CCONV
+record_changes_since (uint64_t generation, uint64_t* current, size_t* size, char* json)
+{
+    auto args = [&] { return arguments (generation, buffer_arg (size, json)); };
+    return record ("changes_since", args, [&] {
+        return real.changes_since (generation, current, size, json);
+    });
+}
+
+static int SSEH_CCONV
+record_detour_priority (const char* name, void* detour, void** original, int priority)
+{
+    auto args = [&] { return arguments (string_arg (name), hex_string (detour), priority); };
+    return record ("detour_priority", args, [&] {
+        return real.detour_priority (name, detour, original, priority);
+    });
+}
+
+static int SSEH_CCONV
+record_find_callers (const char* name, int kinds, size_t* count, uintptr_t* callers)
+{
+    auto args = [&] { return arguments (string_arg (name), kinds, buffer_arg (count, callers)); };
+    return record ("find_callers", args, [&] {
+        return real.find_callers (name, kinds, count, callers);
+    });
+}
+
+static int SSEH_CCONV
+record_find_targets (const char* const* names, size_t count, uintptr_t* targets)
+{
+    auto args = [&] {
+        auto list = nlohmann::json::array ();
+        for (std::size_t i = 0; names && i < count; ++i)
+            list.push_back (string_arg (names[i]));
+        return arguments (std::move (list));
+    };
+    return record ("find_targets", args, [&] {
+        return real.find_targets (names, count, targets);
+    }, [&] (int) {
+        auto list = nlohmann::json::array ();
+        for (std::size_t i = 0; names && targets && i < count; ++i)
+        {
+            nlohmann::json t;
+            if (targets[i])
+                t = hex_string (targets[i]);
+            list.push_back (std::move (t));
+        }
+        return list;
+    });
+}
+
+static int SSEH_CCONV
+record_find_targets_by_id (const uint64_t* ids, size_t count, uintptr_t* targets)
+{
+    auto args = [&] {
+        auto list = nlohmann::json::array ();
+        for (std::size_t i = 0; ids && i < count; ++i)
+            list.push_back (ids[i]);
+        return arguments (std::move (list));
+    };
+    return record ("find_targets_by_id", args, [&] {
+        return real.find_targets_by_id (ids, count, targets);
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+bool
+record_open (std::string const& path)
+{
+    std::lock_guard<std::mutex> lock (record_mutex);
+    record_file.close ();
+    record_file.open (path, std::ios::binary | std::ios::trunc);
+    record_start = std::chrono::steady_clock::now ();
+    record_on.store (record_file.is_open (), std::memory_order_release);
+    return record_file.is_open ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
+bool
+recording ()
+{
+    return record_on.load (std::memory_order_acquire);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+sseh_api
+record_api (sseh_api const& api)
+{
+    real = api;
+    sseh_api rec        = api;
+	rec.version         = record_version;
+	rec.last_error      = record_last_error;
+	rec.init            = record_init;
+	rec.uninit          = record_uninit;
+	rec.profile         = record_profile;
+	rec.find_address    = record_find_address;
+	rec.load            = record_load;
+	rec.map_name        = record_map_name;
+	rec.find_target     = record_find_target;
+	rec.find_name       = record_find_name;
+	rec.detour          = record_detour;
+	rec.enable          = record_enable;
+	rec.disable         = record_disable;
+	rec.enable_all      = record_enable_all;
+	rec.disable_all     = record_disable_all;
+	rec.apply           = record_apply;
+	rec.identify        = record_identify;
+	rec.merge_patch     = record_merge_patch;
+	rec.execute         = record_execute;
+	rec.identify_as     = record_identify_as;
+	rec.merge_patch_as  = record_merge_patch_as;
+	rec.changes_since   = record_changes_since;
+	rec.detour_priority = record_detour_priority;
+	rec.find_callers    = record_find_callers;
+	rec.find_targets    = record_find_targets;
+	rec.find_targets_by_id = record_find_targets_by_id;
+    return rec;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+record_flush ()
+{
+    std::lock_guard<std::mutex> lock (record_mutex);
+    record_file.flush ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+record_close ()
+{
+    record_on.store (false, std::memory_order_release);
+    std::lock_guard<std::mutex> lock (record_mutex);
+    record_file.close ();
+}
+
+//--------------------------------------------------------------------------------------------------
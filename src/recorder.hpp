@@ -0,0 +1,61 @@
+/**
+ * @file recorder.hpp
+ * @brief Optional recording of the calls made through the SSEH interface
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * When enabled, the interface handed to the clients is wrapped so that each call is written as one
+ * line of compact JSON: {"t": start microseconds, "d": duration nanoseconds, "f": function name,
+ * "a": [arguments], "r": result}. Pointers are written as hex strings, binary data as hex bytes and
+ * output buffers only by their given size (or null). The found targets are written out as "o", so
+ * that a replay can check its lookups. The argument of sseh_execute() is written as its command
+ * takes it, or as {"opaque": pointer} for the commands which can't be replayed. The test_replay
+ * program re-issues such file. The recording ends with the startup, the calls after it are only
+ * forwarded.
+ */
+
+#ifndef SSEH_RECORDER_HPP
+#define SSEH_RECORDER_HPP
+
+#include <sse-hooks/sse-hooks.h>
+#include <string>
+
+//--------------------------------------------------------------------------------------------------
+
+/// Starts a new recording into the given file, false if it can't be opened
+bool record_open (std::string const& path);
+
+/// True if #record_open() succeeded
+bool recording ();
+
+/// Make the same interface, but with every call recorded
+sseh_api record_api (sseh_api const& api);
+
+/// Push any pending lines to the file
+void record_flush ();
+
+/// Ends the recording, the wrapped interface forwards each call as it is from now on
+void record_close ();
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_RECORDER_HPP
@@ -31,8 +31,12 @@
 
 #include <sse-hooks/sse-hooks.h>
 #include <utils/winutils.hpp>
+#include <nlohmann/json.hpp>
 
 #include "addrlib.hpp"
+#include "recorder.hpp"
+#include "tracer.hpp"
+#include "commands.hpp"
 
 #include <cstdint>
 typedef std::uint32_t UInt32;
@@ -44,6 +48,7 @@ typedef std::uint64_t UInt64;
 #include <fstream>
 #include <streambuf>
 #include <iomanip>
+#include <cstdlib>
 
 //--------------------------------------------------------------------------------------------------
 
@@ -61,8 +66,10 @@ address_library addrlib;
 
 //--------------------------------------------------------------------------------------------------
 
-static void
-open_log ()
+/// Where SKSE keeps its logs, empty (i.e. the working folder) if unknown
+
+static std::string
+logs_folder ()
 {
     std::string path;
     if (known_folder_path (FOLDERID_Documents, path))
@@ -70,8 +77,32 @@ open_log ()
         // Before plugins are loaded, SKSE takes care to create the directiories
         path += "\\My Games\\Skyrim Special Edition\\SKSE\\";
     }
-    path += "sse-hooks.log";
-    logfile.open (path);
+    return path;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static void
+open_log ()
+{
+    logfile.open (logs_folder () + "sse-hooks.log");
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The "flush-log" command of sseh_execute ()
+
+static bool
+flush_log (void*, std::string& error)
+{
+    logfile.flush ();
+    record_flush ();
+    if (!logfile)
+    {
+        error = "unable to write the log";
+        return false;
+    }
+    return true;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -132,18 +163,24 @@ log_dump ()
 static bool
 merge_patches ()
 {
+    trace_scope trace ("merge patches");
     std::string folder = "Data\\SKSE\\Plugins\\sse-hooks\\";
-    std::vector<std::string> files;
-    if (!enumerate_files (folder + "*.json", files))
+    std::vector<std::string> files, cbor;
+    enumerate_files (folder + "*.json", files);
+    enumerate_files (folder + "*.cbor", cbor);
+    files.insert (files.end (), cbor.begin (), cbor.end ());
+    if (files.empty ())
         return true;
 
     std::string content;
     std::sort (files.begin (), files.end ());
     for (auto const& file: files)
     {
+        trace_scope trace_file ("merge patch", file.c_str ());
         log () << "Merging " << (folder + file) << std::endl;
 
-        std::ifstream fi (folder + file);
+        bool binary = file.size () > 5 && file.compare (file.size () - 5, 5, ".cbor") == 0;
+        std::ifstream fi (folder + file, binary ? std::ios::binary : std::ios::in);
         if (!fi.is_open ())
         {
             log () << "Unable to open " << (folder+file) << " for reading" << std::endl;
@@ -151,7 +188,8 @@ merge_patches ()
         }
         content.assign (std::istreambuf_iterator<char> (fi), std::istreambuf_iterator<char> ());
 
-        if (!sseh_merge_patch (content.c_str ()))
+        if (binary ? !sseh_merge_patch_as (SSEH_FORMAT_CBOR, content.data (), content.size ())
+                   : !sseh_merge_patch (content.c_str ()))
             log_error ();
 
         log_dump ();
@@ -168,9 +206,13 @@ load_addrlib ()
     int maj, min, pat, bld;
     if (process_file_version (maj, min, pat, bld))
     {
-        if (!addrlib.load_txt ())
-            log () << "Unable to load Address Library name mappings." << std::endl;
+        {
+            trace_scope trace ("addrlib names");
+            if (!addrlib.load_txt ())
+                log () << "No Address Library name overrides, using the built-in ones." << std::endl;
+        }
 
+        trace_scope trace ("addrlib database");
         if (!addrlib.load_bin (maj, min, pat, bld))
             log () << "Unable to load Address Library database "
                 << maj << '.' << min << '.' << pat << '.' << bld <<std::endl;
@@ -179,6 +221,22 @@ load_addrlib ()
 
 //--------------------------------------------------------------------------------------------------
 
+/// Ends the startup tracing, if it was started
+
+static void
+write_trace ()
+{
+    if (!trace_enabled)
+        return;
+    auto path = logs_folder () + "sse-hooks.trace.json";
+    if (trace_write (path))
+        log () << "Startup trace written into " << path << std::endl;
+    else
+        log () << "Unable to write " << path << std::endl;
+}
+
+//--------------------------------------------------------------------------------------------------
+
 /// SKSE Post Load allows plugins to register as listeners to SSEH
 /// Hence SKSE Post-Post Load is where the interface is emitted and default hooks applied
 
@@ -191,17 +249,47 @@ void handle_skse_message (SKSEMessagingInterface::Message* m)
     int api;
     sseh_version (&api, nullptr, nullptr, nullptr);
     auto data = sseh_make_api ();
-    messages->Dispatch (plugin, UInt32 (api), &data, sizeof (data), nullptr);
+    if (recording ())
+        data = record_api (data);
+    {
+        trace_scope trace ("dispatch interface");
+        auto given = trace_enabled ? trace_api (data) : data;
+        messages->Dispatch (plugin, UInt32 (api), &given, sizeof (given), nullptr);
+        trace_clients_end ();
+    }
     log () << "SSEH interface broadcasted." << std::endl;
 
-    if (!sseh_apply ())
+    bool applied;
+    {
+        trace_scope trace ("apply");
+        applied = data.apply ();
+    }
+    if (!applied)
     {
         log_error ();
+        record_close ();
+        write_trace ();
         return;
     }
     log () << "Applied." << std::endl;
 
-    messages->Dispatch (plugin, UInt32 (api), nullptr, 0, nullptr);
+    {
+        trace_scope trace ("relayout");
+        std::string s (256, '\0');
+        sseh_text text = { s.size (), &s[0] };
+        if (!sseh_execute ("relayout", &text))
+            log_error ();
+        else if (auto j = nlohmann::json::parse (s.c_str (), nullptr, false);
+                j.is_object () && j.value ("moved", 0) > 0)
+            log () << "Laid out " << j["moved"] << " relays by call counts." << std::endl;
+    }
+
+    {
+        trace_scope trace ("dispatch applied");
+        messages->Dispatch (plugin, UInt32 (api), nullptr, 0, nullptr);
+    }
+    record_close ();
+    write_trace ();
     log () << "All done." << std::endl;
 }
 
@@ -234,7 +322,15 @@ SKSEPlugin_Query (SKSEInterface const* skse, PluginInfo* info)
 extern "C" SSEH_API bool SSEH_CCONV
 SKSEPlugin_Load (SKSEInterface const* skse)
 {
-    open_log ();
+    if (auto env = std::getenv ("SSEH_TRACE"); env && *env && *env != '0')
+        trace_start ();
+    trace_scope trace ("SKSEPlugin_Load");
+
+    {
+        trace_scope trace ("open log");
+        open_log ();
+    }
+    register_command ("flush-log", flush_log);
 
     messages = (SKSEMessagingInterface*) skse->QueryInterface (kInterface_Messaging);
     messages->RegisterListener (plugin, "SKSE", handle_skse_message);
@@ -251,6 +347,23 @@ SKSEPlugin_Load (SKSEInterface const* skse)
     }
     log () << "Initialized." << std::endl;
 
+    if (auto env = std::getenv ("SSEH_LARGE_PAGES"); env && *env && *env != '0')
+    {
+        if (sseh_execute ("large-pages", nullptr))
+            log () << "Carving the trampolines from large pages." << std::endl;
+        else
+            log_error ();
+    }
+
+    if (auto env = std::getenv ("SSEH_RECORD"); env && *env && *env != '0')
+    {
+        auto path = logs_folder () + "sse-hooks.record";
+        if (record_open (path))
+            log () << "Recording the interface calls into " << path << std::endl;
+        else
+            log () << "Unable to open " << path << " for recording" << std::endl;
+    }
+
     if (!merge_patches ())
     {
         log_error ();
@@ -36,7 +36,13 @@
 #include <vector>
 #include <locale>
 #include <algorithm>
+#include <charconv>
+#include <string_view>
 #include <fstream>
+#include <memory>
+#include <deque>
+#include <chrono>
+#include <unordered_map>
 
 #include <windows.h>
 
@@ -45,25 +51,79 @@
 #include <utils/winutils.hpp>
 
 #include "addrlib.hpp"
+#include "arena.hpp"
+#include "commands.hpp"
+#include "functions.hpp"
+#include "modules.hpp"
+#include "strings.hpp"
+#include "vtables.hpp"
+#include "xrefs.hpp"
 
 //--------------------------------------------------------------------------------------------------
 
 using namespace std::string_literals;
 
+/// The registry DOM lives in a pool arena, rather than scattered across the process heap
+typedef nlohmann::basic_json<std::map, std::vector, std::string, bool, std::int64_t,
+        std::uint64_t, double, arena_allocator> registry_json;
+
 /// Shorts code below
-typedef nlohmann::json::json_pointer json_pointer;
+typedef registry_json::json_pointer json_pointer;
 
 /// Supports SSEH specific errors in a manner of #GetLastError() and #FormatMessage()
 static std::string sseh_error;
 
+/// Backing memory of #sseh_json, must outlive it
+static std::unique_ptr<pool_arena> sseh_arena (pool_arena::current = new pool_arena);
+
 /// The JSON configuration database
-static nlohmann::json sseh_json;
+static registry_json sseh_json;
+
+/// Bounded log of registry changes, each one a serialized RFC 6902 operation
+static struct registry_journal
+{
+    std::size_t capacity = 4096;
+    std::uint64_t generation = 0;   ///< Of the last change, the oldest kept is generation-ops.size()+1
+    std::deque<std::string> ops;
+}
+sseh_journal;
 
 /// Remember all used Minhook profiles (for proper init, uninit sequences).
 std::map<std::string, int> sseh_profiles;
 
+/// Index of the profile in use, as stored in #sseh_profiles
+static int sseh_current_profile = 0;
+
 /// Our hook into Minhook to allow multi-state
-extern switch_globals (std::size_t);
+extern void switch_globals (std::size_t);
+
+/// Restores and releases the first N Minhook profiles at once
+extern MH_STATUS uninitialize_globals (std::size_t);
+
+/// Orders the detours on a target of the current profile
+extern MH_STATUS prioritize_hook (void*, int);
+
+/// Applies the queue of the given profile, keeping the chains of the first N profiles ordered
+extern MH_STATUS apply_queued_globals (std::size_t, std::size_t);
+
+/// Adds the memory of the current profile to the counters, returns the frozen threads peak
+extern std::size_t account_globals (std::size_t*, std::size_t*, std::size_t*, std::size_t*,
+        std::size_t*);
+
+/// Collects the targets of the first N profiles with unreachable detours, returns the detours count
+extern std::size_t verify_globals (std::size_t, std::size_t, std::vector<void*>&);
+
+/// Moves the relays of the given targets next to each other, returns the count of the moved
+extern std::size_t relayout_globals (std::size_t, std::size_t, std::vector<void*> const&);
+
+/// New trampoline blocks are carved from large pages, false if the process can't lock them
+extern BOOL UseLargePages (BOOL);
+
+/// Reserves the trampoline blocks for the targets around the address, true if there is a region
+extern BOOL ReserveBuffer (LPVOID);
+
+/// The trampolines are not created if their patches would cross the end found by the callback
+extern VOID SetFunctionEndFinder (LPVOID (*) (LPVOID));
 
 /// Allow clients to interface with the Address Library database
 extern address_library addrlib;
@@ -73,7 +133,7 @@ extern address_library addrlib;
 /// SSEH uses string representation of function address
 
 static bool
-is_pointer (nlohmann::json const& json, std::uintptr_t* request = nullptr)
+is_pointer (registry_json const& json, std::uintptr_t* request = nullptr)
 {
     if (json.is_string ()) try
     {
@@ -143,11 +203,21 @@ try_call (const char* id, Function&& func)
 /// Validate the passed in configuration
 
 static void
-validate (nlohmann::json const& json)
+validate (registry_json const& json)
 {
     for (auto const& it: json["map"].items ())
     {
         auto const& map = it.value ();
+        if (map.contains ("string_ref"))
+        {
+            auto const& ref = map["string_ref"];
+            if (!ref.is_object () || !ref.contains ("string") || !ref["string"].is_string ()
+                    || (ref.contains ("index") && !ref["index"].is_number_unsigned ())
+                    || (ref.contains ("module") && !ref["module"].is_string ()))
+                throw std::runtime_error ("/map/"s + it.key ()
+                        + "/string_ref is not an object of string, optional index and module");
+        }
+
         if (!map.contains ("target"))
             continue;
 
@@ -175,12 +245,184 @@ validate (nlohmann::json const& json)
                 throw std::runtime_error ("/map/"s + it.key () + "/detours/" + di.key ()
                         + "/original does not exist or is not a string address");
             }
+
+            if (detour.contains ("priority") && !detour["priority"].is_number_integer ())
+            {
+                throw std::runtime_error ("/map/"s + it.key () + "/detours/" + di.key ()
+                        + "/priority is not an integer");
+            }
         }
+
+        if (map.contains ("calls") && !map["calls"].is_number_unsigned ())
+            throw std::runtime_error ("/map/"s + it.key () + "/calls is not an unsigned integer");
     }
 }
 
 //--------------------------------------------------------------------------------------------------
 
+/// Figure out the encoding of a registry document, relying on the root being an object.
+
+static int
+detect_format (std::string const& data)
+{
+    if (data.empty ())
+        return SSEH_FORMAT_JSON;
+
+    auto b = std::uint8_t (data.front ());
+    if ((b >= 0xa0 && b <= 0xbb) || b == 0xbf || b == 0xd9) // map or self-describe tag
+        return SSEH_FORMAT_CBOR;
+    if ((b >= 0x80 && b <= 0x8f) || b == 0xde || b == 0xdf) // fixmap, map 16 or map 32
+        return SSEH_FORMAT_MSGPACK;
+    return SSEH_FORMAT_JSON;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Decode a document from a range of bytes in any of the supported formats
+
+static registry_json
+parse_as (int format, const char* begin, const char* end)
+{
+    switch (format)
+    {
+        case SSEH_FORMAT_JSON:
+            return registry_json::parse (begin, end);
+        case SSEH_FORMAT_CBOR:
+            // The self-describe tag (RFC 7049 2.4.5) only marks the data as CBOR
+            if (end - begin >= 3 && !std::memcmp (begin, "\xd9\xd9\xf7", 3))
+                begin += 3;
+            return registry_json::from_cbor (begin, end);
+        case SSEH_FORMAT_MSGPACK:
+            return registry_json::from_msgpack (begin, end);
+    }
+    throw std::runtime_error ("unknown format "s + std::to_string (format));
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Escape a key to be used as a JSON pointer reference token (RFC 6901)
+
+static std::string
+pointer_token (std::string const& key)
+{
+    std::string s;
+    s.reserve (key.size ());
+    for (auto c: key)
+    {
+        if (c == '~') s += "~0";
+        else if (c == '/') s += "~1";
+        else s += c;
+    }
+    return s;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Append an already serialized operation to the journal, keeping it within bounds
+
+static void
+journal (std::string op)
+{
+    sseh_journal.ops.push_back (std::move (op));
+    if (sseh_journal.ops.size () > sseh_journal.capacity)
+        sseh_journal.ops.pop_front ();
+    ++sseh_journal.generation;
+}
+
+/// Record the current value at given path as "add" operation
+
+static void
+journal_add (std::string const& path)
+{
+    registry_json op = {
+        { "op", "add" },
+        { "path", path },
+        { "value", sseh_json.at (json_pointer (path)) }
+    };
+    journal (op.dump ());
+}
+
+/// Marks a change which can not be expressed as operations, so clients have to resync
+
+static void
+journal_reset ()
+{
+    sseh_journal.ops.clear ();
+    ++sseh_journal.generation;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The shallowest of path's ancestors (or itself) which is not yet in the registry.
+/// Used as target of "add" operation, so that the patch is valid when applied in order.
+
+static std::string
+missing_path (std::initializer_list<std::string> keys)
+{
+    std::string path;
+    registry_json const* j = &sseh_json;
+    for (auto const& key: keys)
+    {
+        path += '/' + pointer_token (key);
+        if (!j->is_object () || !j->contains (key))
+            break;
+        j = &(*j)[key];
+    }
+    return path;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Build a new configuration in a fresh arena, swap it in and drop the old arena in one go
+
+template<class Function>
+static void
+rebuild_registry (Function&& build)
+{
+    auto arena = std::make_unique<pool_arena> ();
+    registry_json j;
+
+    pool_arena::current = arena.get ();
+    try
+    {
+        j = build ();
+    }
+    catch (...)
+    {
+        pool_arena::current = sseh_arena.get ();
+        throw;
+    }
+    pool_arena::current = sseh_arena.get ();
+
+    sseh_json.swap (j);
+    j = nullptr; // Give back to the old arena, before it is gone.
+
+    sseh_arena.swap (arena);
+    pool_arena::current = sseh_arena.get ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Common part of the merge patch functions, the applied operations are journaled as they are
+
+template<class Function>
+static void
+merge_patch (Function&& parse)
+{
+    std::vector<std::string> ops;
+    rebuild_registry ([&]
+    {
+        auto patch = parse ();
+        auto j = sseh_json.patch (patch);
+        validate (j);
+        for (auto const& op: patch)
+            ops.push_back (op.dump ());
+        return j;
+    });
+    for (auto& op: ops)
+        journal (std::move (op));
+}
+
 //--------------------------------------------------------------------------------------------------
 
 //--------------------------------------------------------------------------------------------------
@@ -222,10 +464,51 @@ sseh_last_error (size_t* size, char* message)
 
 //--------------------------------------------------------------------------------------------------
 
+/// The range of the function holding the address, from the .pdata of its module. Null if none.
+
+static function_range const*
+function_of (std::uintptr_t address, std::uintptr_t* base)
+{
+    auto m = find_module_of (address);
+    if (!m || !m->size)
+        return nullptr;
+    *base = m->base;
+    return find_functions (*m).find (std::uint32_t (address - m->base));
+}
+
+/// The entry of the function holding the address, zero if not known
+
+static std::uintptr_t
+function_start (std::uintptr_t address)
+{
+    std::uintptr_t base;
+    auto f = function_of (address, &base);
+    return f ? base + f->entry : 0;
+}
+
+/// For the trampoline builder, which runs with the other threads suspended, so it must not take
+/// the heap or the loader lock. The table is parsed beforehand, by #sseh_detour_priority().
+
+static LPVOID
+function_end (LPVOID address)
+{
+    std::uintptr_t base;
+    if (auto f = find_parsed_function (reinterpret_cast<std::uintptr_t> (address), &base))
+        return reinterpret_cast<LPVOID> (base + f->end);
+    return nullptr;
+}
+
+//--------------------------------------------------------------------------------------------------
+
 SSEH_API int SSEH_CCONV
 sseh_init ()
 {
-    return sseh_profile ("");
+    if (!sseh_profile (""))
+        return false;
+    SetFunctionEndFinder (function_end);
+    if (auto m = find_module (""))
+        ReserveBuffer (reinterpret_cast<LPVOID> (m->base));
+    return true;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -233,14 +516,33 @@ sseh_init ()
 SSEH_API void SSEH_CCONV
 sseh_uninit ()
 {
-    for (auto const& p: sseh_profiles)
+    if (sseh_profiles.empty ())
+        return;
+    if (!call_minhook (uninitialize_globals, sseh_profiles.size ()))
     {
-        switch_globals (p.second);
-        if (!call_minhook (MH_Uninitialize))
-        {
-            sseh_error = __func__ + " MH_Uninitialize "s + sseh_error;
-        }
+        sseh_error = __func__ + " uninitialize_globals "s + sseh_error;
+        return;
     }
+    sseh_profiles.clear ();
+    sseh_current_profile = 0;
+    clear_xrefs ();
+    clear_strings ();
+    clear_functions ();
+    clear_vtables ();
+    clear_modules ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Unloaded without #sseh_uninit(), ntdll must not be left calling into the unmapped code. At the
+/// process exit (reserved set) nothing calls back anymore, and its locks may be orphaned.
+
+extern "C" BOOL WINAPI
+DllMain (HINSTANCE, DWORD reason, LPVOID reserved)
+{
+    if (reason == DLL_PROCESS_DETACH && !reserved)
+        ignore_unloads ();
+    return TRUE;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -252,6 +554,7 @@ sseh_profile (const char* profile)
     if (it != sseh_profiles.end ())
     {
         switch_globals (it->second);
+        sseh_current_profile = it->second;
         return true;
     }
 
@@ -261,8 +564,18 @@ sseh_profile (const char* profile)
         sseh_error = __func__ + " MH_Initialize "s + sseh_error;
         return false;
     }
-    sseh_json["profiles"][profile] = sseh_profiles.size ();
-    sseh_profiles.emplace (profile, sseh_profiles.size ());
+    try
+    {
+        auto path = missing_path ({ "profiles", profile });
+        sseh_json["profiles"][profile] = sseh_profiles.size ();
+        journal_add (path);
+    }
+    catch (std::exception const& ex)
+    {
+        sseh_error = __func__ + " "s + ex.what ();
+    }
+    sseh_current_profile = int (sseh_profiles.size ());
+    sseh_profiles.emplace (profile, sseh_current_profile);
     return true;
 }
 
@@ -271,16 +584,12 @@ sseh_profile (const char* profile)
 SSEH_API int SSEH_CCONV
 sseh_find_address (const char* module, const char* name, void** address)
 {
-    std::wstring wm;
     sseh_error.clear ();
-    if (!utf8_to_utf16 (module, wm))
-        return false;
-
-    auto h = ::GetModuleHandle (wm.empty () ? nullptr : wm.c_str ());
-	if (!h)
+    auto m = find_module (module ? module : "");
+	if (!m)
         return false;
 
-    auto p = ::GetProcAddress (h, name);
+    auto p = ::GetProcAddress (m->handle, name);
     if (!p)
         return false;
 
@@ -295,12 +604,20 @@ sseh_load (const char* filepath)
 {
     return try_call (__func__, [&]
     {
-        nlohmann::json j;
-        std::ifstream fi (filepath);
-        if (fi.is_open ()) fi >> j;
-        else j = nlohmann::json::parse (filepath);
-        validate (j);
-        sseh_json.swap (j);
+        rebuild_registry ([&]
+        {
+            registry_json j;
+            std::ifstream fi (filepath, std::ios::binary);
+            if (fi.is_open ())
+            {
+                std::string data (std::istreambuf_iterator<char> (fi), {});
+                j = parse_as (detect_format (data), data.data (), data.data () + data.size ());
+            }
+            else j = registry_json::parse (filepath);
+            validate (j);
+            return j;
+        });
+        journal_reset ();
     });
 }
 
@@ -320,12 +637,106 @@ sseh_map_name (const char* name, uintptr_t address)
 
     return try_call (__func__, [&]
     {
+        auto path = missing_path ({ "map", name, "target" });
         sseh_json["map"][name]["target"] = hex_string (address);
+        journal_add (path);
     });
 }
 
 //--------------------------------------------------------------------------------------------------
 
+/// Maps the target of an entry by the function referencing its "string_ref", false if it has none
+
+static bool
+resolve_string_ref (const char* name, std::uintptr_t* target)
+{
+    auto map = sseh_json.find ("map");
+    if (map == sseh_json.end ())
+        return false;
+    auto entry = map->find (name);
+    if (entry == map->end () || !entry->contains ("string_ref") || entry->contains ("target"))
+        return false;
+
+    auto const& ref = (*entry)["string_ref"];
+    auto m = find_module (ref.value ("module", ""));
+    if (!m || !m->size)
+        throw std::runtime_error ("string_ref module not found");
+
+    std::vector<std::uintptr_t> literals, refs, functions;
+    find_strings (*m).find (m->base, ref["string"].get_ref<std::string const&> (), literals);
+    if (literals.empty ())
+        throw std::runtime_error ("string_ref literal not found");
+
+    auto const& xrefs = find_xrefs (*m);
+    for (auto l: literals)
+        xrefs.find (m->base, l, xref_data, refs);
+    for (auto r: refs)
+        if (auto f = function_start (r))
+            functions.push_back (f);
+    std::sort (functions.begin (), functions.end ());
+    functions.erase (std::unique (functions.begin (), functions.end ()), functions.end ());
+
+    // Without an index, picking one of several functions would differ silently between the builds
+    if (!ref.contains ("index") && functions.size () > 1)
+        throw std::runtime_error ("string_ref ambiguous, "s + std::to_string (functions.size ())
+                + " functions reference it");
+    auto index = ref.value ("index", std::size_t (0));
+    if (index >= functions.size ())
+        throw std::runtime_error ("string_ref index out of "s + std::to_string (functions.size ())
+                + " functions");
+
+    auto path = missing_path ({ "map", name, "target" });
+    (*entry)["target"] = hex_string (functions[index]);
+    journal_add (path);
+    if (target) *target = functions[index];
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// "Class::vtbl" to the table found through the game RTTI, "Class::vtbl[2]" to its third entry
+
+static std::uintptr_t
+find_vtable (std::string_view name)
+{
+    auto at = name.rfind ("::vtbl");
+    if (at == std::string_view::npos || !at)
+        return 0;
+
+    auto slot = name.substr (at + 6);
+    std::size_t entry = 0;
+    if (!slot.empty ())
+    {
+        auto end = slot.data () + slot.size () - 1;
+        if (slot.size () < 3 || slot.front () != '[' || *end != ']'
+                || std::from_chars (slot.data () + 1, end, entry).ptr != end)
+            return 0;
+    }
+
+    auto m = find_module ("");
+    if (!m)
+        return 0;
+    auto v = find_vtables (*m).find (m->base, std::string (name.substr (0, at)));
+    if (!v || slot.empty ())
+        return v;
+
+    // The table ends before the first slot not pointing to code, usually the next locator
+    auto code = [m] (std::uintptr_t a) {
+        for (auto const& s: m->sections)
+            if ((s.characteristics & IMAGE_SCN_MEM_EXECUTE) && a >= s.begin && a < s.end)
+                return true;
+        return false;
+    };
+    auto slots = reinterpret_cast<const std::uintptr_t*> (v);
+    auto n = (m->base + m->size - v) / sizeof (std::uintptr_t);
+    for (std::size_t i = 0; i <= entry; ++i)
+        if (i >= n || !code (slots[i]))
+            return 0;
+    return slots[entry];
+}
+
+//--------------------------------------------------------------------------------------------------
+
 SSEH_API int SSEH_CCONV
 sseh_find_target (const char* name, uintptr_t* target)
 {
@@ -344,9 +755,23 @@ sseh_find_target (const char* name, uintptr_t* target)
         ex_what = ex.what ();
     }
 
+    try // Resolved once, then mapped as any other target
+    {
+        if (resolve_string_ref (name, target))
+            return true;
+    }
+    catch (std::exception const& ex)
+    {
+        sseh_error = __func__ + " "s + ex.what ();
+        return false;
+    }
+
     try // Optional
     {
-        if (auto v = addrlib.find (name); v)
+        auto v = addrlib.find (name);
+        if (!v)
+            v = find_vtable (name);
+        if (v)
         {
             if (target) *target = v;
         }
@@ -356,19 +781,108 @@ sseh_find_target (const char* name, uintptr_t* target)
             return false;
         }
     }
-    catch (std::exception const&)
-    {}
+    catch (std::exception const& ex)
+    {
+        sseh_error = __func__ + " "s + ex.what ();
+        return false;
+    }
 
     return true;
 }
 
 //--------------------------------------------------------------------------------------------------
 
+/// Throws telling how many targets are left 0, naming the first by its query
+
+template<class Name>
+static void
+throw_if_missing (std::uintptr_t const* targets, std::size_t count, Name&& name)
+{
+    auto first = std::find (targets, targets + count, 0);
+    if (first == targets + count)
+        return;
+    auto missing = std::count (first, targets + count, 0);
+    throw std::runtime_error (std::to_string (missing) + " not found, first " + name (first - targets));
+}
+
+//--------------------------------------------------------------------------------------------------
+
+SSEH_API int SSEH_CCONV
+sseh_find_targets (const char* const* names, size_t count, uintptr_t* targets)
+{
+    return try_call (__func__, [&]
+    {
+        if (count && (!names || !targets))
+            throw std::runtime_error ("names or targets not given");
+
+        // Mapped and string_ref entries one by one, the rest in a batch
+        std::vector<std::size_t> rest;
+        auto map = sseh_json.find ("map");
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            targets[i] = 0;
+            if (map != sseh_json.end ())
+                if (auto e = map->find (names[i]); e != map->end ())
+                {
+                    if (auto t = e->find ("target"); t != e->end () && is_pointer (*t, &targets[i]))
+                        continue;
+                    try
+                    {
+                        if (resolve_string_ref (names[i], &targets[i]))
+                            continue;
+                    }
+                    catch (std::exception const&)
+                    {
+                        continue;
+                    }
+                }
+            rest.push_back (i);
+        }
+
+        std::vector<std::string_view> keys;
+        keys.reserve (rest.size ());
+        for (auto i: rest)
+            keys.emplace_back (names[i]);
+        std::vector<std::uint64_t> ids (rest.size ());
+        std::vector<std::uintptr_t> found (rest.size ());
+        addrlib.find_ids (keys.data (), keys.size (), ids.data ());
+        addrlib.find (ids.data (), ids.size (), found.data ());
+
+        for (std::size_t k = 0; k < rest.size (); ++k)
+        {
+            if (!found[k]) try
+            {
+                found[k] = find_vtable (keys[k]);
+            }
+            catch (std::exception const&)
+            {}
+            targets[rest[k]] = found[k];
+        }
+
+        throw_if_missing (targets, count, [names] (std::size_t i) { return std::string (names[i]); });
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+SSEH_API int SSEH_CCONV
+sseh_find_targets_by_id (const uint64_t* ids, size_t count, uintptr_t* targets)
+{
+    return try_call (__func__, [&]
+    {
+        if (count && (!ids || !targets))
+            throw std::runtime_error ("ids or targets not given");
+        addrlib.find (ids, count, targets);
+        throw_if_missing (targets, count, [ids] (std::size_t i) { return "id " + std::to_string (ids[i]); });
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+
 SSEH_API int SSEH_CCONV
 sseh_find_name (uintptr_t target, size_t* size, char* name)
 {
-    sseh_error.clear ();
-    try
+    auto mapped = [] (std::uintptr_t target, std::string& key)
     {
         for (auto const& map: sseh_json["map"].items ())
         {
@@ -378,10 +892,30 @@ sseh_find_name (uintptr_t target, size_t* size, char* name)
                     && is_pointer (value["target"], &address)
                     && address == target)
             {
-                copy_string (map.key (), size, name);
+                key = map.key ();
                 return true;
             }
         }
+        return false;
+    };
+
+    sseh_error.clear ();
+    try
+    {
+        std::string key;
+        if (mapped (target, key))
+        {
+            copy_string (key, size, name);
+            return true;
+        }
+
+        // Otherwise relative to the mapped start of the function holding it
+        auto start = function_start (target);
+        if (start && start != target && mapped (start, key))
+        {
+            copy_string (key + "+" + hex_string (target - start), size, name);
+            return true;
+        }
     }
     catch (std::exception const& ex)
     {
@@ -392,8 +926,43 @@ sseh_find_name (uintptr_t target, size_t* size, char* name)
 
 //--------------------------------------------------------------------------------------------------
 
+SSEH_API int SSEH_CCONV
+sseh_find_callers (const char* name, int kinds, size_t* count, uintptr_t* callers)
+{
+    std::uintptr_t target;
+    if (!sseh_find_target (name, &target))
+        return false;
+
+    return try_call (__func__, [&]
+    {
+        if (!count)
+            throw std::runtime_error ("count not given");
+        auto m = find_module_of (target);
+        if (!m)
+            throw std::runtime_error ("target not in a module");
+
+        std::vector<std::uintptr_t> found;
+        find_xrefs (*m).find (m->base, target, unsigned (kinds), found);
+        std::sort (found.begin (), found.end ());
+
+        if (callers)
+            std::copy_n (found.begin (), std::min (*count, found.size ()), callers);
+        *count = found.size ();
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+
 SSEH_API int SSEH_CCONV
 sseh_detour (const char* name, void* detour, void** original)
+{
+    return sseh_detour_priority (name, detour, original, 0);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+SSEH_API int SSEH_CCONV
+sseh_detour_priority (const char* name, void* detour, void** original, int priority)
 {
     void *target = nullptr,
          *trampoline = nullptr;
@@ -403,6 +972,8 @@ sseh_detour (const char* name, void* detour, void** original)
         std::string map (name, module);
         if (!sseh_find_address (++module, map.c_str (), &target))
             return false;
+        if (auto m = find_module (module))
+            ReserveBuffer (reinterpret_cast<LPVOID> (m->base));
     }
     else
     {
@@ -410,26 +981,51 @@ sseh_detour (const char* name, void* detour, void** original)
             return false;
     }
 
+    // Parsed now, as the trampoline is built later with the other threads suspended
+    try
+    {
+        function_start (reinterpret_cast<std::uintptr_t> (target));
+    }
+    catch (std::exception const&)
+    {}
+
     if (!call_minhook (MH_CreateHook, target, detour, &trampoline))
     {
         sseh_error = __func__ + " MH_CreateHook "s + sseh_error;
         return false;
     }
 
+    // Not left half made, a retry would find it already created
+    if (!call_minhook (prioritize_hook, target, priority))
+    {
+        auto error = __func__ + " prioritize_hook "s + sseh_error;
+        call_minhook (MH_RemoveHook, target);
+        sseh_error = error;
+        return false;
+    }
+
     if (!call_minhook (MH_QueueEnableHook, target))
     {
-        sseh_error = __func__ + " MH_QueueEnableHook "s + sseh_error;
+        auto error = __func__ + " MH_QueueEnableHook "s + sseh_error;
+        call_minhook (MH_RemoveHook, target);
+        sseh_error = error;
         return false;
     }
 
     sseh_error.clear ();
     try
     {
+        auto path = missing_path ({ "map", name, "target" });
         auto& json = sseh_json["map"][name];
         json["target"] = hex_string (target);
+        journal_add (path);
+
+        path = missing_path ({ "map", name, "detours", hex_string (detour) });
         json["detours"][hex_string (detour)] = {
-            { "original", hex_string (trampoline) }
+            { "original", hex_string (trampoline) },
+            { "priority", priority }
         };
+        journal_add (path);
     }
     catch (std::exception const& ex)
     {
@@ -505,9 +1101,9 @@ sseh_disable_all ()
 SSEH_API int SSEH_CCONV
 sseh_apply ()
 {
-    if (!call_minhook (MH_ApplyQueued))
+    if (!call_minhook (apply_queued_globals, sseh_current_profile, sseh_profiles.size ()))
     {
-        sseh_error = __func__ + " MH_ApplyQueued "s + sseh_error;
+        sseh_error = __func__ + " apply_queued_globals "s + sseh_error;
         return false;
     }
     return true;
@@ -533,45 +1129,459 @@ sseh_merge_patch (const char* json)
 {
     return try_call (__func__, [&]
     {
-        auto j = sseh_json.patch (nlohmann::json::parse (json));
-        validate (j);
-        sseh_json.swap (j);
+        merge_patch ([&] { return registry_json::parse (json); });
     });
 }
 
 //--------------------------------------------------------------------------------------------------
 
 SSEH_API int SSEH_CCONV
-sseh_execute (const char* command, void* arg)
+sseh_identify_as (const char* pointer, int format, size_t* size, void* data)
+{
+    return try_call (__func__, [&]
+    {
+        auto const& j = sseh_json.at (json_pointer (pointer == "/"s ? "" : pointer));
+        if (!size)
+            return;
+        auto out = static_cast<char*> (data);
+        switch (format)
+        {
+            case SSEH_FORMAT_JSON:
+                copy_string (j.dump (4), size, out);
+                break;
+            case SSEH_FORMAT_CBOR:
+                copy_string (registry_json::to_cbor (j), size, out);
+                break;
+            case SSEH_FORMAT_MSGPACK:
+                copy_string (registry_json::to_msgpack (j), size, out);
+                break;
+            default:
+                throw std::runtime_error ("unknown format "s + std::to_string (format));
+        }
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+SSEH_API int SSEH_CCONV
+sseh_merge_patch_as (int format, const void* data, size_t size)
+{
+    return try_call (__func__, [&]
+    {
+        auto begin = static_cast<const char*> (data);
+        merge_patch ([&] { return parse_as (format, begin, begin + size); });
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+SSEH_API int SSEH_CCONV
+sseh_changes_since (uint64_t generation, uint64_t* current, size_t* size, char* json)
+{
+    return try_call (__func__, [&]
+    {
+        auto const& jr = sseh_journal;
+        if (current)
+            *current = jr.generation;
+
+        if (generation > jr.generation)
+            throw std::runtime_error ("generation "s + std::to_string (generation)
+                    + " is ahead of " + std::to_string (jr.generation));
+
+        if (generation + jr.ops.size () < jr.generation)
+            throw std::runtime_error ("generation "s + std::to_string (generation)
+                    + " is no longer in the journal, resync the whole registry");
+
+        std::string s = "[";
+        for (auto it = jr.ops.end () - (jr.generation - generation); it != jr.ops.end (); ++it)
+        {
+            if (s.size () > 1) s += ',';
+            s += *it;
+        }
+        s += ']';
+
+        if (size)
+            copy_string (s, size, json);
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Commands of #sseh_execute() by name
+
+static std::unordered_map<std::string, sseh_command>&
+command_table ()
+{
+    static std::unordered_map<std::string, sseh_command> table;
+    return table;
+}
+
+void
+register_command (std::string const& name, sseh_command command)
+{
+    command_table ()[name] = command;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Hands out the text result of a command, as #sseh_identify() does, if it was asked for
+
+static void
+text_result (std::string const& text, void* arg)
+{
+    if (auto out = static_cast<sseh_text*> (arg))
+        copy_string (text, &out->size, out->text);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Fills in #sseh_memory, only what fits in the size given by the caller
+
+static bool
+execute_memory (void* arg, std::string& error)
+{
+    auto out = static_cast<sseh_memory*> (arg);
+    if (!out || out->size < sizeof (out->size))
+    {
+        error = "expects sseh_memory with its size set";
+        return false;
+    }
+
+    sseh_memory m = {};
+    m.registry_reserved = sseh_arena->reserved ();
+    m.registry_used = sseh_arena->used ();
+    m.addrlib_ids = addrlib.ids_size ();
+    m.addrlib_names = addrlib.names_size ();
+    m.profiles = sseh_profiles.size ();
+
+    for (auto const& p: sseh_profiles)
+    {
+        switch_globals (p.second);
+        m.frozen_threads = account_globals (
+                &m.hook_tables, &m.hooks, &m.exec_committed, &m.exec_slots, &m.exec_slots_used);
+    }
+    if (!sseh_profiles.empty ())
+        switch_globals (sseh_current_profile);
+
+    auto size = std::min (out->size, sizeof (m));
+    std::memcpy (reinterpret_cast<char*> (out) + sizeof (m.size),
+                 reinterpret_cast<char*> (&m) + sizeof (m.size), size - sizeof (m.size));
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Counts of what the registry and the profiles hold, as JSON text
+
+static bool
+execute_stats (void* arg, std::string& error)
+{
+    std::size_t names = 0, detours = 0;
+    if (auto it = sseh_json.find ("map"); it != sseh_json.end ())
+    {
+        for (auto const& map: *it)
+        {
+            ++names;
+            if (auto d = map.find ("detours"); d != map.end ())
+                detours += d->size ();
+        }
+    }
+
+    sseh_memory m = {};
+    m.size = sizeof (m);
+    if (!execute_memory (&m, error))
+        return false;
+
+    text_result (nlohmann::json {
+        { "names", names },
+        { "detours", detours },
+        { "profiles", m.profiles },
+        { "hooks", m.hooks },
+        { "generation", sseh_journal.generation },
+        { "journal", sseh_journal.ops.size () }
+    }.dump (4), arg);
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Times the frequent registry queries on what is currently mapped, as JSON text
+
+static bool
+execute_benchmark (void* arg, std::string& error)
+{
+    std::vector<std::string> names;
+    if (auto it = sseh_json.find ("map"); it != sseh_json.end ())
+        for (auto map = it->begin (); map != it->end () && names.size () < 1024; ++map)
+            names.push_back (map.key ());
+
+    using namespace std::chrono;
+    auto average = [] (auto&& func, std::size_t n) {
+        auto t = steady_clock::now ();
+        for (std::size_t i = 0; i < n; ++i)
+            func (i);
+        return n ? duration_cast<nanoseconds> (steady_clock::now () - t).count () / n : 0;
+    };
+
+    auto find_target = average ([&names] (std::size_t i) {
+        std::uintptr_t target;
+        sseh_find_target (names[i].c_str (), &target);
+    }, names.size ());
+
+    std::vector<const char*> batch;
+    for (auto const& name: names)
+        batch.push_back (name.c_str ());
+    std::vector<std::uintptr_t> targets (batch.size ());
+    auto find_targets = names.empty () ? 0 : average ([&] (std::size_t) {
+        sseh_find_targets (batch.data (), batch.size (), targets.data ());
+    }, 16) / names.size ();
+
+    auto identify = average ([] (std::size_t) {
+        std::size_t n = 0;
+        sseh_identify ("/", &n, nullptr);
+    }, 16);
+
+    sseh_memory m = {};
+    m.size = sizeof (m);
+    auto memory = average ([&m, &error] (std::size_t) { execute_memory (&m, error); }, 16);
+
+    text_result (nlohmann::json {
+        { "names", names.size () },
+        { "find_target_ns", find_target },
+        { "find_targets_ns", find_targets },
+        { "identify_ns", identify },
+        { "memory_ns", memory }
+    }.dump (4), arg);
+    sseh_error.clear ();
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Writes the registry into a file, in the binary formats if the file extension says so
+
+static bool
+execute_snapshot_save (void* arg, std::string& error)
+{
+    auto path = static_cast<const char*> (arg);
+    if (!path || !*path)
+    {
+        error = "expects a file path";
+        return false;
+    }
+
+    auto ends_with = [path = std::string (path)] (const char* ext) {
+        auto n = std::strlen (ext);
+        return path.size () > n && path.compare (path.size () - n, n, ext) == 0;
+    };
+
+    std::ofstream fo (path, std::ios::binary | std::ios::trunc);
+    if (ends_with (".cbor"))
+        registry_json::to_cbor (sseh_json, fo);
+    else if (ends_with (".msgpack"))
+        registry_json::to_msgpack (sseh_json, fo);
+    else
+        fo << sseh_json.dump (4);
+
+    if (!fo)
+    {
+        error = "unable to write "s + path;
+        return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Checks the registry and walks the detour chains, the broken ones are reported as JSON text
+
+static bool
+execute_verify (void* arg, std::string& error)
 {
+    validate (sseh_json);
+
+    std::vector<void*> broken;
+    auto detours = verify_globals (sseh_current_profile, sseh_profiles.size (), broken);
+
+    auto names = nlohmann::json::array ();
+    for (auto target: broken)
+    {
+        std::size_t n = 0;
+        if (sseh_find_name (std::uintptr_t (target), &n, nullptr))
+        {
+            std::string name (n, '\0');
+            sseh_find_name (std::uintptr_t (target), &n, &name[0]);
+            names.push_back (name.c_str ());
+        }
+        else names.push_back (hex_string (target));
+    }
+    sseh_error.clear ();
+
+    text_result (nlohmann::json {
+        { "detours", detours },
+        { "broken", names }
+    }.dump (4), arg);
+
+    if (!broken.empty ())
+    {
+        error = std::to_string (broken.size ()) + " broken detour chains";
+        return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+execute_large_pages (void*, std::string& error)
+{
+    if (UseLargePages (TRUE))
+        return true;
+    error = "large pages are not available, the Lock pages in memory right may be missing";
     return false;
 }
 
 //--------------------------------------------------------------------------------------------------
 
+/// Lays out the relays of the targets by their call counts in the registry, as JSON text
+
+static bool
+execute_relayout (void* arg, std::string&)
+{
+    std::vector<std::pair<std::uint64_t, void*>> counts;
+    if (auto it = sseh_json.find ("map"); it != sseh_json.end ())
+    {
+        for (auto const& map: *it)
+        {
+            std::uintptr_t target;
+            auto calls = map.find ("calls");
+            auto t = map.find ("target");
+            if (calls != map.end () && calls->is_number_unsigned () && calls->get<std::uint64_t> ()
+                    && t != map.end () && is_pointer (*t, &target))
+                counts.emplace_back (calls->get<std::uint64_t> (), reinterpret_cast<void*> (target));
+        }
+    }
+
+    std::stable_sort (counts.begin (), counts.end (), [] (auto const& a, auto const& b) {
+        return a.first > b.first;
+    });
+    std::vector<void*> hot;
+    hot.reserve (counts.size ());
+    for (auto const& c: counts)
+        hot.push_back (c.second);
+
+    // Most load orders have no counts at all, the hooks are not even looked at then
+    std::size_t moved = 0;
+    if (!hot.empty ())
+        moved = relayout_globals (sseh_current_profile, sseh_profiles.size (), hot);
+
+    text_result (nlohmann::json {
+        { "counted", hot.size () },
+        { "moved", moved }
+    }.dump (4), arg);
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Maps each "Class::vtbl" of the game not mapped yet, the counts as JSON text
+
+static bool
+execute_vtables (void* arg, std::string& error)
+{
+    auto m = find_module ("");
+    if (!m || !m->size)
+    {
+        error = "game module not found";
+        return false;
+    }
+
+    std::size_t mapped = 0;
+    auto const& tables = find_vtables (*m).tables;
+    auto& map = sseh_json["map"];
+    for (auto const& t: tables)
+    {
+        auto name = t.first + "::vtbl";
+        if (map.contains (name))
+            continue;
+        auto path = missing_path ({ "map", name, "target" });
+        map[name]["target"] = hex_string (m->base + t.second);
+        journal_add (path);
+        ++mapped;
+    }
+
+    text_result (nlohmann::json {
+        { "found", tables.size () },
+        { "mapped", mapped }
+    }.dump (4), arg);
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static const bool builtin_commands = []
+{
+    register_command ("memory", execute_memory);
+    register_command ("stats", execute_stats);
+    register_command ("benchmark", execute_benchmark);
+    register_command ("snapshot-save", execute_snapshot_save);
+    register_command ("verify", execute_verify);
+    register_command ("large-pages", execute_large_pages);
+    register_command ("relayout", execute_relayout);
+    register_command ("vtables", execute_vtables);
+    return true;
+} ();
+
+//--------------------------------------------------------------------------------------------------
+
+SSEH_API int SSEH_CCONV
+sseh_execute (const char* command, void* arg)
+{
+    return try_call (__func__, [&]
+    {
+        auto const& table = command_table ();
+        auto it = table.find (command ? command : "");
+        if (it == table.end ())
+            throw std::runtime_error ("unknown command "s + (command ? command : "(null)"));
+
+        std::string error;
+        if (!it->second (arg, error))
+            throw std::runtime_error (command + " "s + error);
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+
 SSEH_API sseh_api SSEH_CCONV
 sseh_make_api ()
 {
-    sseh_api api     = {};
-	api.version      = sseh_version;
-	api.last_error   = sseh_last_error;
-	api.init         = sseh_init;
-	api.uninit       = sseh_uninit;
-	api.profile      = sseh_profile;
-	api.find_address = sseh_find_address;
-	api.load         = sseh_load;
-	api.map_name     = sseh_map_name;
-	api.find_target  = sseh_find_target;
-	api.find_name    = sseh_find_name;
-	api.detour       = sseh_detour;
-	api.enable       = sseh_enable;
-	api.disable      = sseh_disable;
-	api.enable_all   = sseh_enable_all;
-	api.disable_all  = sseh_disable_all;
-	api.apply        = sseh_apply;
-	api.identify     = sseh_identify;
-	api.merge_patch  = sseh_merge_patch;
-	api.execute      = sseh_execute;
+    sseh_api api        = {};
+	api.version         = sseh_version;
+	api.last_error      = sseh_last_error;
+	api.init            = sseh_init;
+	api.uninit          = sseh_uninit;
+	api.profile         = sseh_profile;
+	api.find_address    = sseh_find_address;
+	api.load            = sseh_load;
+	api.map_name        = sseh_map_name;
+	api.find_target     = sseh_find_target;
+	api.find_name       = sseh_find_name;
+	api.detour          = sseh_detour;
+	api.enable          = sseh_enable;
+	api.disable         = sseh_disable;
+	api.enable_all      = sseh_enable_all;
+	api.disable_all     = sseh_disable_all;
+	api.apply           = sseh_apply;
+	api.identify        = sseh_identify;
+	api.merge_patch     = sseh_merge_patch;
+	api.execute         = sseh_execute;
+	api.identify_as     = sseh_identify_as;
+	api.merge_patch_as  = sseh_merge_patch_as;
+	api.changes_since   = sseh_changes_since;
+	api.detour_priority = sseh_detour_priority;
+	api.find_callers    = sseh_find_callers;
+	api.find_targets    = sseh_find_targets;
+	api.find_targets_by_id = sseh_find_targets_by_id;
     return api;
 }
 
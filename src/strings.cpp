@@ -0,0 +1,236 @@
+/**
+ * @file strings.cpp
+ * @copybrief strings.hpp
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * The data sections are classified 16 bytes at a time with SSE2, into text, null and other bytes.
+ * Only the boundaries between them are visited one by one: the starts of text after a null, the
+ * nulls after text and the other bytes breaking the text. Each thread takes a slice and keeps the
+ * literals starting inside it, reading past its end only to finish the last one.
+ */
+
+#include "strings.hpp"
+#include "cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------
+
+/// Shorter runs are mostly bytes of other data which happen to be printable
+static constexpr std::size_t min_literal = 4;
+
+static std::unordered_map<std::uintptr_t, string_index> indexes;
+
+//--------------------------------------------------------------------------------------------------
+
+static std::uint64_t
+text_hash (const char* p, std::size_t n)
+{
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    for (auto e = p + n; p != e; ++p)
+        h = (h ^ std::uint8_t (*p)) * 0x100000001b3ull;
+    return h;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+string_index::find (std::uintptr_t base, std::string_view text,
+                    std::vector<std::uintptr_t>& out) const
+{
+    auto h = text_hash (text.data (), text.size ());
+    auto first = std::lower_bound (literals.begin (), literals.end (), h,
+            [] (string_literal const& l, std::uint64_t h) { return l.hash < h; });
+    for (; first != literals.end () && first->hash == h; ++first)
+        if (first->size == text.size ()
+                && !std::memcmp (reinterpret_cast<const char*> (base + first->rva),
+                                 text.data (), text.size ()))
+            out.push_back (base + first->rva);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Index of the lowest set bit, the value must not be zero
+
+static inline unsigned
+lowest_bit (unsigned bits)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward (&i, bits);
+    return i;
+#else
+    return __builtin_ctz (bits);
+#endif
+}
+
+/// Bit per byte of up to 16 bytes, the ones past the end are in none of the masks
+struct byte_classes
+{
+    unsigned text, null, other;
+};
+
+static byte_classes
+classify (const std::uint8_t* p, std::size_t n)
+{
+    if (n == 16)
+    {
+        auto x = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (p));
+        auto text = _mm_and_si128 (_mm_cmpgt_epi8 (x, _mm_set1_epi8 (0x1f)),
+                                   _mm_cmplt_epi8 (x, _mm_set1_epi8 (0x7f)));
+        text = _mm_or_si128 (text, _mm_cmpeq_epi8 (x, _mm_set1_epi8 ('\t')));
+        text = _mm_or_si128 (text, _mm_cmpeq_epi8 (x, _mm_set1_epi8 ('\n')));
+        text = _mm_or_si128 (text, _mm_cmpeq_epi8 (x, _mm_set1_epi8 ('\r')));
+        unsigned t = _mm_movemask_epi8 (text);
+        unsigned z = _mm_movemask_epi8 (_mm_cmpeq_epi8 (x, _mm_setzero_si128 ()));
+        return { t, z, ~(t | z) & 0xffffu };
+    }
+
+    byte_classes c = {};
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        auto b = p[i];
+        if (!b)
+            c.null |= 1u << i;
+        else if ((b >= 0x20 && b < 0x7f) || b == '\t' || b == '\n' || b == '\r')
+            c.text |= 1u << i;
+        else
+            c.other |= 1u << i;
+    }
+    return c;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The literals starting in [begin, end) of the section [first, last)
+
+static void
+scan (std::uintptr_t base, std::uintptr_t first, std::uintptr_t last,
+      std::uintptr_t begin, std::uintptr_t end, std::vector<string_literal>& out)
+{
+    unsigned prev_null = begin == first || !*reinterpret_cast<const std::uint8_t*> (begin - 1);
+    unsigned prev_text = 0;
+    std::uintptr_t open = 0;
+
+    for (auto p = begin; p < last && (p < end || open); p += 16)
+    {
+        auto c = classify (reinterpret_cast<const std::uint8_t*> (p),
+                           std::min<std::uintptr_t> (16, last - p));
+        unsigned starts = c.text & ((c.null << 1) | prev_null);
+        unsigned ends = c.null & ((c.text << 1) | prev_text);
+
+        // A start always follows the end of the previous literal, so it is never seen while open
+        for (auto events = starts | ends | c.other; events; events &= events - 1)
+        {
+            auto i = lowest_bit (events);
+            auto at = p + i;
+            if (starts >> i & 1)
+            {
+                if (at >= end)
+                    return;
+                open = at;
+                continue;
+            }
+            if ((ends >> i & 1) && open && at - open >= min_literal)
+                out.push_back (string_literal {
+                        text_hash (reinterpret_cast<const char*> (open), at - open),
+                        std::uint32_t (open - base), std::uint32_t (at - open) });
+            open = 0;
+            if (at >= end)
+                return;
+        }
+
+        prev_null = c.null >> 15 & 1;
+        prev_text = c.text >> 15 & 1;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Scans all data sections, split among the hardware threads
+
+static void
+build (module_info const& m, std::vector<string_literal>& literals)
+{
+    std::vector<module_section const*> data;
+    std::vector<std::size_t> sizes;
+    for (auto const& s: m.sections)
+        if (s.is_data ())
+        {
+            data.push_back (&s);
+            sizes.push_back (s.end - s.begin);
+        }
+
+    scan_slices (sizes,
+        [&m, &data] (std::size_t i, std::size_t begin, std::size_t end,
+                     std::vector<string_literal>& out) {
+            auto s = data[i];
+            scan (m.base, s->begin, s->end, s->begin + begin, s->begin + end, out);
+        },
+        [] (string_literal const& a, string_literal const& b) {
+            return a.hash < b.hash || (a.hash == b.hash && a.rva < b.rva);
+        }, literals);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+string_index const&
+find_strings (module_info const& m)
+{
+    if (!m.size)
+        throw std::runtime_error ("not a PE image");
+
+    auto hash = module_hash (m);
+    auto& x = indexes[m.base];
+    if (x.hash == hash)
+        return x;
+
+    x.hash = hash;
+    x.literals.clear ();
+
+    load_or_build (hash, "strings", x.literals, [&m] (std::vector<string_literal>& literals) {
+        build (m, literals);
+        return true;
+    });
+    return x;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+clear_strings ()
+{
+    indexes.clear ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
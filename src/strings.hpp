@@ -0,0 +1,67 @@
+/**
+ * @file strings.hpp
+ * @brief Index of the string literals in a module, looked up by their contents
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * A literal is a run of at least four printable ASCII characters, tabs or line breaks in the data
+ * sections, preceded and terminated by a null. Together with the references from #find_xrefs(),
+ * this finds the functions using a given text, which rarely changes between the game builds.
+ */
+
+#ifndef SSEH_STRINGS_HPP
+#define SSEH_STRINGS_HPP
+
+#include "modules.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+
+/// Relative to the module base, the hash is of the characters
+struct string_literal
+{
+    std::uint64_t hash;
+    std::uint32_t rva, size;
+};
+
+struct string_index
+{
+    std::uint64_t hash;                     ///< Of the module headers
+    std::vector<string_literal> literals;   ///< Ordered by hash, then by address
+
+    /// Appends the addresses of the literals with exactly this text
+    void find (std::uintptr_t base, std::string_view text, std::vector<std::uintptr_t>& out) const;
+};
+
+/// Loads or builds the index of the module on first use
+string_index const& find_strings (module_info const& m);
+
+/// Drops the indexes in memory, the ones on disk stay
+void clear_strings ();
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_STRINGS_HPP
+
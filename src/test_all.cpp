@@ -28,10 +28,25 @@
 
 #include <sse-hooks/sse-hooks.h>
 #include <nlohmann/json.hpp>
+#include <MinHook.h>
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cctype>
 #include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "addrlib.hpp"
+#include "arena.hpp"
+#include "test_image.hpp"
+#include "vtables.hpp"
 
 //--------------------------------------------------------------------------------------------------
 
@@ -46,6 +61,26 @@ typedef json::json_pointer json_pointer;
 
 //--------------------------------------------------------------------------------------------------
 
+/// Allocates a slot in a trampoline block reachable from the address, as read by the code
+extern LPVOID AllocateBuffer (LPVOID);
+
+/// Returns the slot to its block, the block is released once it has none in use
+extern VOID FreeBuffer (LPVOID);
+
+/// The same address in the read-write view of its block, as written by MinHook
+extern LPVOID WritableBuffer (LPVOID);
+
+/// New trampoline blocks are carved from large pages, false if the process can't lock them
+extern BOOL UseLargePages (BOOL);
+
+/// The committed bytes, the slots and the used slots of the blocks of the current profile
+extern VOID GetBufferUsage (SIZE_T*, UINT*, UINT*);
+
+/// Maps a region ahead for the blocks reachable from the address, true if there is one
+extern BOOL ReserveBuffer (LPVOID);
+
+//--------------------------------------------------------------------------------------------------
+
 static std::string
 last_error ()
 {
@@ -131,6 +166,185 @@ test_patching ()
 
 //--------------------------------------------------------------------------------------------------
 
+static bool
+test_binary_formats ()
+{
+    bool result = true;
+    TEST (sseh_load (generic_json));
+
+    std::size_t n = 0;
+    TEST (sseh_identify_as ("/", SSEH_FORMAT_CBOR, &n, nullptr));
+    std::string cbor (n, '\0');
+    TEST (sseh_identify_as ("/", SSEH_FORMAT_CBOR, &n, &cbor[0]));
+    cbor.resize (n - 1);
+
+    std::ofstream ("test.cbor", std::ios::binary) << cbor;
+    TEST (sseh_load ("test.cbor"));
+    std::ofstream ("test.cbor", std::ios::binary) << "\xd9\xd9\xf7" << cbor;
+    TEST (sseh_load ("test.cbor"));
+    std::remove ("test.cbor");
+
+    auto patch = json::to_msgpack (json::parse (
+                R"([{ "op": "add", "path": "/map/Foo", "value": { "target": "0x1234" } }])"));
+    TEST (sseh_merge_patch_as (SSEH_FORMAT_MSGPACK, patch.data (), patch.size ()));
+
+    // With the self-describe tag in front
+    auto tagged = json::to_cbor (json::parse (
+                R"([{ "op": "add", "path": "/map/Tagged", "value": { "target": "0x5678" } }])"));
+    tagged.insert (tagged.begin (), { 0xd9, 0xd9, 0xf7 });
+    TEST (sseh_merge_patch_as (SSEH_FORMAT_CBOR, tagged.data (), tagged.size ()));
+
+    std::uintptr_t target = 0;
+    TEST (sseh_find_target ("IDXGISwapChain::Present", &target));
+    TEST ((target == 0x7ffe834b5070));
+    TEST (sseh_find_target ("Foo", &target));
+    TEST ((target == 0x1234));
+    TEST (sseh_find_target ("Tagged", &target));
+    TEST ((target == 0x5678));
+    TEST (!sseh_merge_patch_as (-1, patch.data (), patch.size ()));
+
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_journal ()
+{
+    bool result = true;
+    TEST (sseh_load (generic_json));
+
+    std::uint64_t gen = 0;
+    TEST (!sseh_changes_since (0, &gen, nullptr, nullptr));
+
+    std::size_t n = 0;
+    TEST (sseh_identify ("/", &n, nullptr));
+    std::string s (n, '\0');
+    TEST (sseh_identify ("/", &n, &s[0]));
+    auto copy = json::parse (s.c_str ());
+
+    TEST (sseh_map_name ("Bar/Baz", 0x42));
+    TEST (sseh_merge_patch (R"([{ "op": "add", "path": "/map/Foo", "value": { "target": "0x1" } }])"));
+
+    std::uint64_t now = 0;
+    TEST (sseh_changes_since (gen, &now, &n, nullptr));
+    TEST ((now == gen + 2));
+    s.assign (n, '\0');
+    TEST (sseh_changes_since (gen, &now, &n, &s[0]));
+    copy = copy.patch (json::parse (s.c_str ()));
+
+    TEST (sseh_identify ("/", &n, nullptr));
+    s.assign (n, '\0');
+    TEST (sseh_identify ("/", &n, &s[0]));
+    TEST ((copy == json::parse (s.c_str ())));
+
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Bytes and blocks in use by the std::allocator baseline of the registry DOM
+
+static std::size_t counted_bytes = 0, counted_blocks = 0;
+
+template<class T>
+struct counting_allocator : std::allocator<T>
+{
+    template<class U> struct rebind { typedef counting_allocator<U> other; };
+
+    counting_allocator () noexcept = default;
+    template<class U> counting_allocator (counting_allocator<U> const&) noexcept {}
+
+    T* allocate (std::size_t n)
+    {
+        counted_bytes += n * sizeof (T);
+        ++counted_blocks;
+        return std::allocator<T>::allocate (n);
+    }
+
+    void deallocate (T* p, std::size_t n) noexcept
+    {
+        counted_bytes -= n * sizeof (T);
+        --counted_blocks;
+        std::allocator<T>::deallocate (p, n);
+    }
+};
+
+/// Mostly a timing report, how a registry with many names goes through load and patch, in the
+/// pool arena and with std::allocator, same DOM otherwise
+
+static bool
+test_large_registry ()
+{
+    bool result = true;
+
+    json j;
+    for (int i = 0; i < 20000; ++i)
+        j["map"]["Name" + std::to_string (i)]["target"] = std::to_string (0x1000 + i);
+    auto content = j.dump ();
+    const char* patch = R"([{ "op": "add", "path": "/map/Name0/_comment", "value": "" }])";
+
+    using std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    auto us = [] (auto d) { return duration_cast<microseconds> (d).count (); };
+
+    auto t0 = steady_clock::now ();
+    TEST (sseh_load (content.c_str ()));
+    auto t1 = steady_clock::now ();
+    TEST (sseh_merge_patch (patch));
+    auto t2 = steady_clock::now ();
+
+    std::uintptr_t target = 0;
+    TEST (sseh_find_target ("Name19999", &target));
+    TEST ((target == 0x1000 + 19999));
+
+    sseh_memory m = {};
+    m.size = sizeof (m);
+    TEST (sseh_execute ("memory", &m));
+
+    typedef nlohmann::basic_json<std::map, std::vector, std::string, bool, std::int64_t,
+            std::uint64_t, double, arena_allocator> arena_json;
+    typedef nlohmann::basic_json<std::map, std::vector, std::string, bool, std::int64_t,
+            std::uint64_t, double, counting_allocator> heap_json;
+
+    pool_arena arena;
+    pool_arena::current = &arena;
+    auto t3 = steady_clock::now ();
+    auto a = arena_json::parse (content);
+    auto t4 = steady_clock::now ();
+    auto a2 = a.patch (arena_json::parse (patch));
+    auto t5 = steady_clock::now ();
+    auto arena_used = arena.used (), arena_reserved = arena.reserved ();
+    a = a2 = nullptr;
+    pool_arena::current = nullptr;
+
+    counted_bytes = counted_blocks = 0;
+    auto t6 = steady_clock::now ();
+    auto h = heap_json::parse (content);
+    auto t7 = steady_clock::now ();
+    auto h2 = h.patch (heap_json::parse (patch));
+    auto t8 = steady_clock::now ();
+    auto heap_used = counted_bytes, heap_blocks = counted_blocks;
+    TEST ((h2["map"].size () == 20000));
+
+    std::cout << __func__
+              << " sseh load " << us (t1 - t0) << "us patch " << us (t2 - t1) << "us"
+              << " arena " << m.registry_used << '/' << m.registry_reserved << " bytes\n"
+              << __func__
+              << " arena parse " << us (t4 - t3) << "us patch " << us (t5 - t4) << "us "
+              << arena_used << '/' << arena_reserved << " bytes,"
+              << " std::allocator parse " << us (t7 - t6) << "us patch " << us (t8 - t7) << "us "
+              << heap_used << " bytes in " << heap_blocks << " blocks" << std::endl;
+
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
 bool test_parse_ints ()
 {
     int a, b, c, d;
@@ -162,13 +376,949 @@ bool test_parse_ints ()
 
 //--------------------------------------------------------------------------------------------------
 
+/// Where a "jmp rel32" or "jmp qword [rip+0]", with a segment prefix or not, goes. Null if neither.
+
+static std::uint8_t*
+jump_destination (std::uint8_t* p)
+{
+    if (p[0] == 0x2E)
+        ++p;
+    if (p[0] == 0xE9)
+    {
+        std::int32_t rel;
+        std::memcpy (&rel, p + 1, sizeof (rel));
+        return p + 5 + rel;
+    }
+    if (p[0] == 0xFF && p[1] == 0x25 && !p[2] && !p[3] && !p[4] && !p[5])
+    {
+        std::uint8_t* abs;
+        std::memcpy (&abs, p + 6, sizeof (abs));
+        return abs;
+    }
+    return nullptr;
+}
+
+/// Stubs of the detours on a synthetic function, in the order they are called
+
+static std::vector<std::size_t>
+detour_order (synthetic_image& image, std::size_t function, std::size_t stubs)
+{
+    auto find_stub = [&] (std::uint8_t* p) {
+        std::size_t s = 0;
+        while (s < stubs && image.stub (s) != p)
+            ++s;
+        return s;
+    };
+    std::vector<std::size_t> order;
+    for (auto hop = jump_destination (image.function (function)); hop; )
+    {
+        // The patch goes through a relay, the trampolines straight to the next detour
+        auto s = find_stub (hop);
+        if (s == stubs)
+            s = find_stub (jump_destination (hop));
+        if (s == stubs)
+            break;
+        order.push_back (s);
+        hop = jump_destination (static_cast<std::uint8_t*> (image.original (s)));
+    }
+    return order;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_priority ()
+{
+    bool result = true;
+    synthetic_image image;
+    TEST (image.make (1, 3));
+    TEST (sseh_init ());
+    TEST (sseh_map_name ("Synthetic", std::uintptr_t (image.function (0))));
+
+    // Applied in order of the profiles, expected to be called by priority
+    int priority[] = { 0, 10, 5 };
+    for (std::size_t s = 0; s < 3; ++s)
+    {
+        TEST (sseh_profile (("Priority" + std::to_string (s)).c_str ()));
+        TEST (sseh_detour_priority ("Synthetic", image.stub (s), &image.original (s), priority[s]));
+        TEST (sseh_apply ());
+    }
+    TEST ((detour_order (image, 0, 3) == std::vector<std::size_t> { 1, 2, 0 }));
+    TEST (image.call (0));
+
+    // Flattened, the trampolines skip the relays of the next detours
+    TEST ((jump_destination (static_cast<std::uint8_t*> (image.original (1))) == image.stub (2)));
+    TEST ((jump_destination (static_cast<std::uint8_t*> (image.original (2))) == image.stub (0)));
+
+    // The trampolines are written through another view, they are never writable and executable
+    MEMORY_BASIC_INFORMATION mbi;
+    TEST ((::VirtualQuery (image.original (0), &mbi, sizeof (mbi)) == sizeof (mbi)));
+    TEST ((mbi.Protect == PAGE_EXECUTE_READ));
+
+    // Rebuilt chains stay in order
+    TEST (sseh_disable ("Synthetic"));
+    TEST (sseh_apply ());
+    TEST ((detour_order (image, 0, 3) == std::vector<std::size_t> { 1, 0 }));
+    TEST ((jump_destination (static_cast<std::uint8_t*> (image.original (1))) == image.stub (0)));
+    TEST (sseh_enable ("Synthetic"));
+    TEST (sseh_apply ());
+    TEST ((detour_order (image, 0, 3) == std::vector<std::size_t> { 1, 2, 0 }));
+    TEST (image.call (0));
+    for (std::size_t s = 0; s < 3; ++s)
+        TEST ((image.counter (s) == 2));
+
+    std::size_t n = 0;
+    std::ostringstream pointer;
+    pointer << "/map/Synthetic/detours/0x" << std::hex << std::uintptr_t (image.stub (1))
+            << "/priority";
+    TEST (sseh_identify (pointer.str ().c_str (), &n, nullptr));
+    std::string s (n, '\0');
+    TEST (sseh_identify (pointer.str ().c_str (), &n, &s[0]));
+    TEST ((json::parse (s.c_str ()) == 10));
+
+    sseh_uninit ();
+    TEST (image.call (0));
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The hook table of MinHook, linked in here too, as SSEH never removes a single hook on its own
+
+static bool
+test_hook_table ()
+{
+    bool result = true;
+    constexpr std::size_t count = 140;
+    synthetic_image image;
+    TEST (image.make (count, count));
+    TEST ((MH_Initialize () == MH_OK));
+
+    std::vector<bool> created (count), enabled (count);
+    std::vector<std::uint64_t> calls (count);
+
+    // Every hook is found at its own position and its enable bit is the one of the same hook
+    auto verify = [&] {
+        bool ok = true;
+        for (std::size_t f = 0; f < count; ++f)
+        {
+            auto target = image.function (f);
+            if (!created[f])
+                ok = ok && MH_EnableHook (target) == MH_ERROR_NOT_CREATED;
+            else if (enabled[f])
+                ok = ok && MH_EnableHook (target) == MH_ERROR_ENABLED;
+            else
+                ok = ok && MH_DisableHook (target) == MH_ERROR_DISABLED;
+            if (created[f] && enabled[f])
+                ++calls[f];
+            ok = ok && image.call (f) && image.counter (f) == calls[f];
+        }
+        return ok;
+    };
+
+    // Grows from the initial capacity of 32 hooks, over several 64 bit words
+    for (std::size_t f = 0; f < count; ++f)
+    {
+        TEST ((MH_CreateHook (image.function (f), image.stub (f), &image.original (f)) == MH_OK));
+        created[f] = true;
+    }
+    TEST ((MH_CreateHook (image.function (count - 1), image.stub (0), nullptr)
+                == MH_ERROR_ALREADY_CREATED));
+    TEST (verify ());
+    TEST ((MH_QueueEnableHook (MH_ALL_HOOKS) == MH_OK));
+    TEST ((MH_ApplyQueued () == MH_OK));
+    enabled.assign (count, true);
+    TEST (verify ());
+
+    // The bits around the word boundaries
+    for (std::size_t f: { 63, 64, 65 })
+    {
+        TEST ((MH_DisableHook (image.function (f)) == MH_OK));
+        enabled[f] = false;
+        TEST (verify ());
+    }
+    for (std::size_t f: { 63, 64, 65 })
+    {
+        TEST ((MH_EnableHook (image.function (f)) == MH_OK));
+        enabled[f] = true;
+    }
+    TEST (verify ());
+
+    // Removed from the front, each time the last hook is swapped into the hole with its enable
+    // bit set, and with its queued bit set or not. The table shrinks back on the way.
+    for (std::size_t f = 1; f < count; f += 2)
+        TEST ((MH_QueueDisableHook (image.function (f)) == MH_OK));
+    constexpr std::size_t removed = 110;
+    for (std::size_t f = 0; f < removed; ++f)
+    {
+        TEST ((MH_RemoveHook (image.function (f)) == MH_OK));
+        created[f] = enabled[f] = false;
+        TEST (verify ());
+    }
+    TEST ((MH_RemoveHook (image.function (0)) == MH_ERROR_NOT_CREATED));
+    TEST ((MH_ApplyQueued () == MH_OK));
+    for (std::size_t f = removed; f < count; ++f)
+        enabled[f] = f % 2 == 0;
+    TEST (verify ());
+
+    // Added again, nothing is left enabled or queued past the end of the table
+    for (std::size_t f = 0; f < removed; ++f)
+    {
+        TEST ((MH_CreateHook (image.function (f), image.stub (f), &image.original (f)) == MH_OK));
+        created[f] = true;
+        TEST (verify ());
+    }
+    TEST ((MH_ApplyQueued () == MH_OK));
+    TEST (verify ());
+
+    TEST ((MH_Uninitialize () == MH_OK));
+    for (std::size_t f = 0; f < count; ++f)
+        TEST ((image.call (f) && image.counter (f) == calls[f]));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_exec_buffer ()
+{
+    bool result = true;
+    synthetic_image image;
+    TEST (image.make (1, 0));
+    TEST ((MH_Initialize () == MH_OK));
+
+    auto code = static_cast<std::uint8_t*> (AllocateBuffer (image.function (0)));
+    auto writable = static_cast<std::uint8_t*> (WritableBuffer (code));
+    TEST ((code && writable && writable != code));
+
+    // Written through one view, seen and run through the other
+    static const std::uint8_t ret[] = { 0xB8, 0x78, 0x56, 0x34, 0x12, 0xC3 }; // mov eax, imm32; ret
+    std::memcpy (writable, ret, sizeof (ret));
+    ::FlushInstructionCache (::GetCurrentProcess (), code, sizeof (ret));
+    TEST ((std::memcmp (code, ret, sizeof (ret)) == 0));
+    TEST ((reinterpret_cast<std::uint32_t (*) ()> (code) () == 0x12345678));
+
+    // The code is mapped without write access, so it can't be made writable either
+    MEMORY_BASIC_INFORMATION mbi;
+    TEST ((::VirtualQuery (code, &mbi, sizeof (mbi)) == sizeof (mbi)));
+    TEST ((mbi.Protect == PAGE_EXECUTE_READ && mbi.AllocationProtect == PAGE_EXECUTE_READ));
+    TEST ((::VirtualQuery (writable, &mbi, sizeof (mbi)) == sizeof (mbi)));
+    TEST ((mbi.Protect == PAGE_READWRITE));
+    DWORD old;
+    TEST (!::VirtualProtect (code, sizeof (ret), PAGE_EXECUTE_READWRITE, &old));
+    TEST (!::VirtualProtect (code, sizeof (ret), PAGE_READWRITE, &old));
+
+    FreeBuffer (code);
+    TEST ((MH_Uninitialize () == MH_OK));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_large_pages_fallback ()
+{
+    bool result = true;
+    synthetic_image image;
+    TEST (image.make (1, 0));
+
+    // As for most users, the process has no "Lock pages in memory" right anymore
+    HANDLE token;
+    TEST (::OpenProcessToken (::GetCurrentProcess (), TOKEN_ADJUST_PRIVILEGES, &token));
+    TOKEN_PRIVILEGES tp = {};
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_REMOVED;
+    TEST (::LookupPrivilegeValue (nullptr, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid));
+    ::AdjustTokenPrivileges (token, FALSE, &tp, 0, nullptr, nullptr);
+    ::CloseHandle (token);
+
+    TEST (!sseh_execute ("large-pages", nullptr));
+    TEST ((last_error ().find ("Lock pages in memory") != std::string::npos));
+
+    // The blocks are made of small pages then, carved and released as ever
+    TEST ((MH_Initialize () == MH_OK));
+    TEST (!UseLargePages (TRUE));
+    std::vector<std::uint8_t*> slots;
+    for (int i = 0; i < 100; ++i)
+    {
+        auto slot = static_cast<std::uint8_t*> (AllocateBuffer (image.function (0)));
+        TEST (slot);
+        if (!slot)
+            break;
+        *static_cast<std::uint8_t*> (WritableBuffer (slot)) = std::uint8_t (i);
+        TEST ((*slot == std::uint8_t (i)));
+        slots.push_back (slot);
+    }
+
+    SIZE_T committed;
+    UINT total, used;
+    GetBufferUsage (&committed, &total, &used);
+    TEST ((used == slots.size () && total >= used && committed > 0));
+    for (auto slot: slots)
+        FreeBuffer (slot);
+    GetBufferUsage (&committed, &total, &used);
+    TEST ((committed == 0 && total == 0 && used == 0));
+
+    TEST ((MH_Uninitialize () == MH_OK));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_reserved_buffer ()
+{
+    bool result = true;
+    constexpr std::size_t block_size = 0x1000;
+    constexpr std::size_t reserve_size = 0x1000000;
+    TEST ((MH_Initialize () == MH_OK));
+
+    // Targets in this module get their blocks from the region reserved for it, within a rel32 jump
+    auto origin = reinterpret_cast<std::uint8_t*> (&test_reserved_buffer);
+    auto reachable = [origin] (std::uint8_t* p) {
+        return p && std::uint64_t (p > origin ? p - origin : origin - p) < 0x80000000ull;
+    };
+    TEST (ReserveBuffer (origin));
+    auto first = static_cast<std::uint8_t*> (AllocateBuffer (origin));
+    auto first_writable = static_cast<std::uint8_t*> (WritableBuffer (first));
+    TEST (reachable (first));
+    MEMORY_BASIC_INFORMATION mbi = {};
+    TEST ((::VirtualQuery (first, &mbi, sizeof (mbi)) == sizeof (mbi)));
+    auto base = static_cast<std::uint8_t*> (mbi.AllocationBase);
+    TEST ((::VirtualQuery (first_writable, &mbi, sizeof (mbi)) == sizeof (mbi)));
+    auto writable = static_cast<std::uint8_t*> (mbi.AllocationBase);
+
+    // Carved until the region is used up, then the blocks are allocated one by one
+    std::uint8_t* outside = nullptr;
+    for (std::size_t n = 0; first && !outside; ++n)
+    {
+        auto slot = static_cast<std::uint8_t*> (AllocateBuffer (origin));
+        TEST (reachable (slot));
+        if (!slot || n > reserve_size)
+            break;
+        if (slot < base || slot >= base + reserve_size)
+            outside = slot;
+    }
+    TEST (reachable (outside));
+    SIZE_T committed;
+    UINT total, used;
+    GetBufferUsage (&committed, &total, &used);
+    TEST ((committed == reserve_size + block_size));
+    auto block = reinterpret_cast<std::uint8_t*> (std::uintptr_t (outside) & ~(block_size - 1));
+    TEST ((::VirtualQuery (outside, &mbi, sizeof (mbi)) == sizeof (mbi)));
+    TEST ((mbi.AllocationBase == block && mbi.Protect == PAGE_EXECUTE_READ));
+
+    // Both views of the region go away with the last of its blocks
+    TEST ((MH_Uninitialize () == MH_OK));
+    TEST ((::VirtualQuery (base, &mbi, sizeof (mbi)) == sizeof (mbi) && mbi.State == MEM_FREE));
+    TEST ((::VirtualQuery (writable, &mbi, sizeof (mbi)) == sizeof (mbi) && mbi.State == MEM_FREE));
+    TEST ((::VirtualQuery (block, &mbi, sizeof (mbi)) == sizeof (mbi) && mbi.State == MEM_FREE));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_relayout ()
+{
+    bool result = true;
+    synthetic_image image;
+    TEST (image.make (3, 4));
+    TEST (sseh_init ());
+    TEST (sseh_load (R"({ "map": {} })"));
+    for (std::size_t f = 0; f < 3; ++f)
+    {
+        auto name = "Synthetic" + std::to_string (f);
+        TEST (sseh_map_name (name.c_str (), std::uintptr_t (image.function (f))));
+        TEST (sseh_detour (name.c_str (), image.stub (f), &image.original (f)));
+    }
+    TEST (sseh_apply ());
+
+    // No counts, nothing to lay out
+    std::string s (4096, '\0');
+    sseh_text text = { s.size (), &s[0] };
+    auto before = jump_destination (image.function (0));
+    TEST (sseh_execute ("relayout", &text));
+    TEST ((json::parse (s.c_str ()) == json { { "counted", 0 }, { "moved", 0 } }));
+    TEST ((jump_destination (image.function (0)) == before));
+
+    TEST (sseh_merge_patch (R"([
+        { "op": "add", "path": "/map/Synthetic0/calls", "value": 200 },
+        { "op": "add", "path": "/map/Synthetic1/calls", "value": 100 },
+        { "op": "add", "path": "/map/Synthetic2/calls", "value": 300 }
+    ])"));
+    TEST (!sseh_merge_patch (R"([{ "op": "add", "path": "/map/Synthetic0/calls", "value": -1 }])"));
+
+    text.size = s.size ();
+    TEST (sseh_execute ("relayout", &text));
+    TEST ((json::parse (s.c_str ())["moved"] == 3));
+
+    // Hottest first, each in the slot next to the previous one
+    auto relay = [&image] (std::size_t f) { return jump_destination (image.function (f)); };
+    auto step = relay (0) - relay (2);
+    TEST (((step == 64 || step == -64) && relay (1) - relay (0) == step));
+    TEST ((std::uintptr_t (relay (2)) / 4096 == std::uintptr_t (relay (1)) / 4096));
+    for (std::size_t f = 0; f < 3; ++f)
+        TEST (image.call (f));
+
+    // Moved once, survives the rebuilt chains
+    text.size = s.size ();
+    TEST (sseh_execute ("relayout", &text));
+    TEST ((json::parse (s.c_str ())["moved"] == 0));
+    TEST (sseh_disable ("Synthetic0"));
+    TEST (sseh_apply ());
+    TEST (image.call (0));
+    TEST (sseh_enable ("Synthetic0"));
+    TEST (sseh_apply ());
+    TEST ((relay (0) - relay (2) == step));
+
+    // Only the relay the patch goes through is moved, the rest are skipped by the trampolines
+    TEST (sseh_profile ("Relayout"));
+    TEST (sseh_detour_priority ("Synthetic0", image.stub (3), &image.original (3), 10));
+    TEST (sseh_apply ());
+    text.size = s.size ();
+    TEST (sseh_execute ("relayout", &text));
+    TEST ((json::parse (s.c_str ())["moved"] == 1));
+    TEST ((detour_order (image, 0, 4) == std::vector<std::size_t> { 3, 0 }));
+    TEST (image.call (0));
+    text.size = s.size ();
+    TEST (sseh_execute ("verify", &text));
+
+    for (std::size_t f = 0; f < 3; ++f)
+        TEST ((image.counter (f) == (f ? 1 : 2)));
+    TEST ((image.counter (3) == 1));
+
+    sseh_uninit ();
+    for (std::size_t f = 0; f < 3; ++f)
+        TEST (image.call (f));
+    TEST ((image.counter (0) == 2));
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_function_end ()
+{
+    bool result = true;
+
+    // The decoder goes on past "xor eax, eax; int 0x29" into "mov eax, 1; ret", under the patch
+    static const std::uint8_t code[] = {
+        0x31, 0xC0, 0xCD, 0x29,
+        0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3
+    };
+    synthetic_module module;
+    TEST (module.make (code, sizeof (code), { { 0, 4 }, { 4, 10 } }));
+    synthetic_image image;
+    TEST (image.make (0, 2));
+
+    TEST (sseh_init ());
+    TEST (sseh_load (R"({ "map": {} })"));
+    TEST (sseh_map_name ("EndsEarly", std::uintptr_t (module.at (0))));
+    TEST (sseh_detour ("EndsEarly", image.stub (0), &image.original (0)));
+    TEST (!sseh_apply ());
+    TEST ((module.at (0)[0] == 0x31));
+    sseh_uninit ();
+
+    TEST (sseh_init ());
+    TEST (sseh_load (R"({ "map": {} })"));
+    TEST (sseh_map_name ("EndsLater", std::uintptr_t (module.at (4))));
+    TEST (sseh_detour ("EndsLater", image.stub (1), &image.original (1)));
+    TEST (sseh_apply ());
+    TEST ((reinterpret_cast<std::uint32_t (*) ()> (module.at (4)) () == 1));
+    TEST ((image.counter (1) == 1));
+    sseh_uninit ();
+    TEST ((reinterpret_cast<std::uint32_t (*) ()> (module.at (4)) () == 1));
+    TEST ((image.counter (1) == 1));
+
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The original of a non-leaf function, on the stack while it calls back
+
+static void (*unwind_original) (void (*) ());
+
+static void
+unwind_detour (void (*callback) ())
+{
+    unwind_original (callback);
+}
+
+static void
+unwind_thrower ()
+{
+    throw std::runtime_error ("unwind");
+}
+
+static bool
+test_trampoline_unwind ()
+{
+    bool result = true;
+
+    // No growable function tables before Windows 8, the trampolines are left leaf functions
+    auto ntdll = ::GetModuleHandleW (L"ntdll.dll");
+    if (!ntdll || !::GetProcAddress (ntdll, "RtlAddGrowableFunctionTable"))
+        return result;
+
+    // "sub rsp, 28h; call rcx" is copied, so the callback returns onto the final jump
+    static const std::uint8_t code[] = {
+        0x48, 0x83, 0xEC, 0x28, 0xFF, 0xD1,
+        0x48, 0x83, 0xC4, 0x28, 0xC3
+    };
+    synthetic_module module;
+    TEST (module.make (code, sizeof (code), { { 0, 11, { 1, 4, 1, 0, 4, 0x42, 0, 0 } } }));
+
+    TEST (sseh_init ());
+    TEST (sseh_load (R"({ "map": {} })"));
+    TEST (sseh_map_name ("CallsBack", std::uintptr_t (module.at (0))));
+    TEST (sseh_detour ("CallsBack", reinterpret_cast<void*> (unwind_detour),
+                       reinterpret_cast<void**> (&unwind_original)));
+    TEST (sseh_apply ());
+
+    DWORD64 base = 0;
+    auto entry = ::RtlLookupFunctionEntry (DWORD64 (unwind_original), &base, nullptr);
+    TEST (entry);
+    if (entry)
+    {
+        auto info = reinterpret_cast<const std::uint8_t*> (base + entry->UnwindData);
+        TEST ((base + entry->BeginAddress == DWORD64 (unwind_original)));
+        TEST ((info[1] == 4 && info[2] == 1 && info[4] == 4 && info[5] == 0x42));
+    }
+
+    bool caught = false;
+    try
+    {
+        reinterpret_cast<void (*) (void (*) ())> (module.at (0)) (unwind_thrower);
+    }
+    catch (std::runtime_error const&)
+    {
+        caught = true;
+    }
+    TEST (caught);
+
+    sseh_uninit ();
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_module_cache ()
+{
+    bool result = true;
+    static const std::uint8_t code[] = {
+        0x31, 0xC0, 0xC3,
+        0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3
+    };
+    std::string file, upper;
+    for (auto c: synthetic_module::name ())
+        file += char (c), upper += char (std::toupper (c));
+
+    synthetic_module module;
+    TEST (module.make (code, sizeof (code), { { 0, 3 }, { 3, 9 } }, { { "One", 3 }, { "Zero", 0 } }));
+    void* address = nullptr;
+    TEST ((sseh_find_address (file.c_str (), "Zero", &address) && address == module.at (0)));
+    TEST ((sseh_find_address (upper.c_str (), "One", &address) && address == module.at (3)));
+    TEST (!sseh_find_address (file.c_str (), "Two", &address));
+
+    // Loaded again elsewhere, as its old place is taken, under the same name
+    auto old = module.at (0);
+    module.unload ();
+    auto placeholder = ::VirtualAlloc (old - 0x1000, 0x2000, MEM_RESERVE, PAGE_NOACCESS);
+    TEST (placeholder);
+    TEST (module.make (code, sizeof (code), { { 0, 3 }, { 3, 9 } }, { { "One", 3 }, { "Zero", 0 } }));
+    TEST ((module.at (0) != old));
+    TEST ((sseh_find_address (file.c_str (), "Zero", &address) && address == module.at (0)));
+    TEST ((sseh_find_address (upper.c_str (), "One", &address) && address == module.at (3)));
+    if (placeholder)
+        ::VirtualFree (placeholder, 0, MEM_RELEASE);
+
+    module.unload ();
+    TEST (!sseh_find_address (file.c_str (), "Zero", &address));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_find_targets ()
+{
+    bool result = true;
+    TEST (sseh_load (generic_json));
+    TEST (sseh_map_name ("Foo", 0x1234));
+
+    const char* names[] = { "Foo", "Missing", "IDXGISwapChain::Present" };
+    std::uintptr_t targets[3] = { 1, 1, 1 };
+    TEST (!sseh_find_targets (names, 3, targets));
+    TEST ((targets[0] == 0x1234 && targets[1] == 0 && targets[2] == 0x7ffe834b5070));
+    TEST (sseh_find_targets (names, 1, targets));
+    TEST (sseh_find_targets (nullptr, 0, nullptr));
+
+    // No Address Library database in the tests
+    std::uint64_t ids[] = { 514960 };
+    TEST (!sseh_find_targets_by_id (ids, 1, targets));
+    TEST ((targets[0] == 0));
+
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Writes an Address Library database with each (id, offset) record stored in full
+
+static bool
+write_addrlib (std::string const& path,
+               std::vector<std::pair<std::uint64_t, std::uint64_t>> const& records)
+{
+    std::ofstream f (path, std::ios::binary);
+    auto put = [&f] (auto v) { f.write (reinterpret_cast<const char*> (&v), sizeof (v)); };
+    put (int (1));
+    for (int i = 0; i < 5; ++i)
+        put (int (0));
+    put (int (sizeof (void*)));
+    put (int (records.size ()));
+    for (auto const& r: records)
+    {
+        put (std::uint8_t (0));
+        put (r.first);
+        put (r.second);
+    }
+    return bool (f);
+}
+
+static bool
+test_addrlib_batch ()
+{
+    bool result = true;
+    ::CreateDirectoryA ("Data", nullptr);
+    ::CreateDirectoryA ("Data\\SKSE", nullptr);
+    ::CreateDirectoryA ("Data\\SKSE\\Plugins", nullptr);
+    const char* path = "Data\\SKSE\\Plugins\\version-0-0-0-1.bin";
+
+    for (std::size_t size: { 1, 2, 3, 7, 64, 1000 })
+    {
+        // Every third id, so that the ones in between miss
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> records;
+        for (std::size_t i = 0; i < size; ++i)
+            records.emplace_back (10 + 3 * i, 0x1000 + 16 * i);
+        TEST (write_addrlib (path, records));
+        address_library lib;
+        TEST (lib.load_bin (0, 0, 0, 1));
+
+        auto first = records.front ().first, last = records.back ().first;
+        std::vector<std::uint64_t> ids = { last, 0, first, first - 1, last + 1, first, last, last };
+        for (std::size_t i = 0; i < size; i += 1 + size / 16)
+            ids.insert (ids.end (), { records[i].first, records[i].first + 1, records[i].first });
+        for (std::size_t i = 0; i < size; ++i)
+            TEST ((lib.find (records[i].first) == records[i].second));
+        TEST ((!lib.find (first - 1) && !lib.find (first + 1) && !lib.find (last + 1)));
+
+        std::vector<std::uintptr_t> out (ids.size (), 1);
+        lib.find (ids.data (), ids.size (), out.data ());
+        for (std::size_t i = 0; i < ids.size (); ++i)
+            TEST ((out[i] == (ids[i] ? lib.find (ids[i]) : 0)));
+    }
+    std::remove (path);
+
+    // The compiled in names, as no names file was loaded
+    std::vector<std::string> names = { "", "~Missing", "0Missing" };
+    for (std::size_t i = 0; i < addrlib_defaults.size (); i += 1 + addrlib_defaults.size () / 32)
+        names.emplace_back (addrlib_defaults[i].first);
+    names.emplace_back (addrlib_defaults.front ().first);
+    names.emplace_back (addrlib_defaults.back ().first);
+    names.emplace_back (addrlib_defaults.back ().first);
+
+    address_library lib;
+    std::vector<std::string_view> keys (names.begin (), names.end ());
+    std::vector<std::uint64_t> ids (keys.size (), 1);
+    lib.find_ids (keys.data (), keys.size (), ids.data ());
+    for (std::size_t i = 0; i < keys.size (); ++i)
+        TEST ((ids[i] == lib.find_id (names[i])));
+    TEST ((!ids[0] && !ids[1] && !ids[2] && ids.back () == addrlib_defaults.back ().second));
+
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_find_callers ()
+{
+    bool result = true;
+    TEST (sseh_init ());
+
+    // Taking the address is a RIP-relative reference already, whatever the compiler inlines
+    TEST (sseh_map_name ("TestVersion", std::uintptr_t (&test_sseh_version)));
+    std::size_t n = 0;
+    TEST (sseh_find_callers ("TestVersion", SSEH_XREF_CALL | SSEH_XREF_JUMP | SSEH_XREF_DATA,
+                             &n, nullptr));
+    std::vector<std::uintptr_t> callers (n);
+    TEST ((n > 0 && sseh_find_callers ("TestVersion", SSEH_XREF_DATA, &n, callers.data ())));
+    TEST ((n > 0 && n <= callers.size ()));
+
+    synthetic_image image;
+    TEST (image.make (1, 0));
+    TEST (sseh_map_name ("Synthetic", std::uintptr_t (image.function (0))));
+    TEST (!sseh_find_callers ("Synthetic", SSEH_XREF_CALL, &n, nullptr));
+    TEST (!sseh_find_callers ("Unmapped", SSEH_XREF_CALL, &n, nullptr));
+
+    sseh_uninit ();
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Not a leaf, so it has unwind data, and the literal is not folded away
+static std::size_t
+string_ref_user ()
+{
+    std::ostringstream os;
+    os << "SSEH string_ref test literal";
+    return os.str ().size ();
+}
+
+static bool
+test_string_ref ()
+{
+    bool result = true;
+    TEST (sseh_init ());
+    std::size_t (*volatile user) () = string_ref_user;
+    TEST ((user () > 0));
+
+    TEST (!sseh_merge_patch (R"([{ "op": "add", "path": "/map/StringRefBad",
+                                   "value": { "string_ref": { "index": 0 } } }])"));
+    TEST (sseh_merge_patch (R"([{ "op": "add", "path": "/map/StringRefMissing",
+                                  "value": { "string_ref": { "string": "SSEH no such literal" } } }])"));
+    std::uintptr_t target = 0;
+    TEST (!sseh_find_target ("StringRefMissing", &target));
+
+    TEST (sseh_merge_patch (R"([{ "op": "add", "path": "/map/StringRefUser",
+                                  "value": { "string_ref": { "string": "SSEH string_ref test literal" } } }])"));
+    TEST (sseh_find_target ("StringRefUser", &target));
+    std::string s (64, '\0');
+    std::size_t n = s.size ();
+    TEST ((sseh_find_name (target, &n, &s[0]) && std::string (s.c_str ()) == "StringRefUser"));
+
+    sseh_uninit ();
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Polymorphic, so the compiler emits its virtual table, after a locator with MSVC
+struct vtable_probe
+{
+    virtual ~vtable_probe () = default;
+    virtual int value () const { return 1; }
+};
+
+static bool
+test_vtables ()
+{
+    bool result = true;
+    auto undecorated = [] (const char* s) { return undecorate_class (s, std::strlen (s)); };
+    TEST ((undecorated (".?AVInner@Outer@@") == "Outer::Inner"));
+    TEST ((undecorated (".?AVA@B@C@@") == "C::B::A"));
+    TEST ((undecorated (".?AUPlain@@") == "Plain"));
+    TEST ((undecorated (".?AV?$Tmpl@H@@").empty ()));
+    TEST ((undecorated (".?AVInner@?$Tmpl@H@@@").empty ()));
+    TEST ((undecorated (".?AVHidden@?A0x1a2b3c4d@@").empty ()));
+    TEST ((undecorated (".?AV@@").empty ()));
+    TEST ((undecorated (".?AV@Outer@@").empty ()));
+    TEST ((undecorated (".?AVInner@@Outer@@").empty ()));
+    TEST ((undecorated (".?AVx@@@").empty ()));
+    TEST ((undecorated (".?AVx@").empty ()));
+    TEST ((undecorated (".?AXPlain@@").empty ()));
+    TEST ((undecorated ("").empty ()));
+
+#ifdef _MSC_VER
+    // This program is the main module, its own table is found through its RTTI
+    TEST (sseh_init ());
+    vtable_probe probe;
+    std::uintptr_t table, target = 0;
+    std::memcpy (&table, static_cast<const void*> (&probe), sizeof (table));
+    TEST ((sseh_find_target ("vtable_probe::vtbl", &target) && target == table));
+    TEST ((sseh_find_target ("vtable_probe::vtbl[1]", &target)
+                && target == reinterpret_cast<const std::uintptr_t*> (table)[1]));
+    TEST (!sseh_find_target ("vtable_probe::vtbl[2]", &target));
+    TEST (!sseh_find_target ("vtable_probe::vtbl[x]", &target));
+    sseh_uninit ();
+    TEST (sseh_load (generic_json));
+#endif
+
+    // With its headers wiped the main module is no PE image, the lookup fails instead of the target
+    // being left as it was
+    if (auto dos = reinterpret_cast<IMAGE_DOS_HEADER*> (::GetModuleHandleW (nullptr)))
+    {
+        TEST (sseh_init ());
+        DWORD protection;
+        TEST (::VirtualProtect (dos, sizeof (*dos), PAGE_READWRITE, &protection));
+        auto magic = dos->e_magic;
+        dos->e_magic = 0;
+        std::uintptr_t target = 1;
+        TEST (!sseh_find_target ("vtable_probe::vtbl", &target));
+        dos->e_magic = magic;
+        ::VirtualProtect (dos, sizeof (*dos), protection, &protection);
+        TEST ((target == 1 && last_error ().find ("not a PE image") != std::string::npos));
+        sseh_uninit ();
+        TEST (sseh_load (generic_json));
+    }
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The DLL itself is the sample PE, its exported functions have .pdata entries
+static bool
+test_function_names ()
+{
+    bool result = true;
+    TEST (sseh_init ());
+
+    void* init = nullptr;
+    TEST (sseh_find_address ("sse-hooks.dll", "sseh_init", &init));
+    TEST (sseh_map_name ("Init", std::uintptr_t (init)));
+    std::string s (64, '\0');
+    std::size_t n = s.size ();
+    TEST ((sseh_find_name (std::uintptr_t (init) + 1, &n, &s[0]) && std::string (s.c_str ()) == "Init+0x1"));
+    TEST (!sseh_find_name (std::uintptr_t (&s), &n, nullptr));
+
+    sseh_uninit ();
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_memory ()
+{
+    bool result = true;
+    synthetic_image image;
+    TEST (image.make (2, 2));
+    TEST (sseh_init ());
+    TEST (sseh_map_name ("Synthetic0", std::uintptr_t (image.function (0))));
+    TEST (sseh_map_name ("Synthetic1", std::uintptr_t (image.function (1))));
+    TEST (sseh_detour ("Synthetic0", image.stub (0), &image.original (0)));
+    TEST (sseh_detour ("Synthetic1", image.stub (1), &image.original (1)));
+    TEST (sseh_apply ());
+
+    sseh_memory m = {};
+    TEST (!sseh_execute ("memory", &m));
+    m.size = sizeof (m);
+    TEST (sseh_execute ("memory", &m));
+    TEST ((m.registry_used > 0 && m.registry_used <= m.registry_reserved));
+    TEST ((m.profiles == 1 && m.hooks == 2 && m.hook_tables > 0));
+    TEST ((m.exec_slots_used == 2 && m.exec_slots >= 2 && m.exec_committed > 0));
+
+    // Older clients know less fields
+    sseh_memory old = {};
+    old.size = offsetof (sseh_memory, profiles);
+    TEST (sseh_execute ("memory", &old));
+    TEST ((old.registry_used == m.registry_used && old.profiles == 0));
+
+    using std::chrono::steady_clock;
+    auto t = steady_clock::now ();
+    for (int i = 0; i < 1000; ++i)
+        sseh_execute ("memory", &m);
+    std::cout << __func__ << " " << std::chrono::duration_cast<std::chrono::nanoseconds> (
+            steady_clock::now () - t).count () / 1000 << "ns" << std::endl;
+
+    sseh_uninit ();
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+test_execute ()
+{
+    bool result = true;
+    synthetic_image image;
+    TEST (image.make (2, 2));
+    TEST (sseh_init ());
+    TEST (sseh_load (R"({ "map": {} })"));
+    TEST (sseh_map_name ("Synthetic0", std::uintptr_t (image.function (0))));
+    TEST (sseh_map_name ("Synthetic1", std::uintptr_t (image.function (1))));
+    TEST (sseh_detour ("Synthetic0", image.stub (0), &image.original (0)));
+    TEST (sseh_detour ("Synthetic1", image.stub (1), &image.original (1)));
+    TEST (sseh_apply ());
+
+    TEST (!sseh_execute ("no such command", nullptr));
+    TEST (!sseh_execute (nullptr, nullptr));
+
+    std::string s (4096, '\0');
+    sseh_text text = { s.size (), &s[0] };
+    TEST (sseh_execute ("stats", &text));
+    auto stats = json::parse (s.c_str ());
+    TEST ((stats["detours"] == 2 && stats["hooks"] == 2 && stats["profiles"] == 1));
+
+    text.size = s.size ();
+    TEST (sseh_execute ("benchmark", &text));
+    TEST ((json::parse (s.c_str ())["names"] == 2));
+
+    text.size = s.size ();
+    TEST (sseh_execute ("verify", &text));
+    TEST ((json::parse (s.c_str ())["detours"] == 2));
+
+    // As if something else restored the original code
+    auto copy = reinterpret_cast<std::uint8_t*> (image.original (1));
+    DWORD old;
+    ::VirtualProtect (image.function (1), 5, PAGE_EXECUTE_READWRITE, &old);
+    std::memcpy (image.function (1), copy, 5);
+    text.size = s.size ();
+    TEST (!sseh_execute ("verify", &text));
+    TEST ((json::parse (s.c_str ())["broken"] == json::array ({ "Synthetic1" })));
+
+    TEST (sseh_execute ("snapshot-save", (void*) "test-snapshot.cbor"));
+    sseh_uninit ();
+
+    TEST (sseh_load ("test-snapshot.cbor"));
+    std::remove ("test-snapshot.cbor");
+    std::uintptr_t target = 0;
+    TEST (sseh_find_target ("Synthetic1", &target));
+    TEST ((target == std::uintptr_t (image.function (1))));
+
+    TEST (sseh_load (generic_json));
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+
 int main ()
 {
     int ret = 0;
     ret += test_sseh_version ();
     ret += test_loading ();
     ret += test_patching ();
+    ret += test_binary_formats ();
+    ret += test_journal ();
+    ret += test_large_registry ();
     ret += test_parse_ints ();
+    ret += test_priority ();
+    ret += test_hook_table ();
+    ret += test_exec_buffer ();
+    ret += test_large_pages_fallback ();
+    ret += test_reserved_buffer ();
+    ret += test_relayout ();
+    ret += test_function_end ();
+    ret += test_trampoline_unwind ();
+    ret += test_module_cache ();
+    ret += test_find_targets ();
+    ret += test_addrlib_batch ();
+    ret += test_find_callers ();
+    ret += test_string_ref ();
+    ret += test_vtables ();
+    ret += test_function_names ();
+    ret += test_memory ();
+    ret += test_execute ();
     return ret;
 }
 
@@ -0,0 +1,326 @@
+/**
+ * @file test_image.hpp
+ * @brief Synthetic executable code to detour, shared by the test programs
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Public API
+ *
+ * @details
+ * Stands in for the game image and the client plugins' code. Each function returns its own index,
+ * each stub counts how many times it was called and continues to the original it got from SSEH.
+ * The synthetic module is a real DLL instead, for the code which needs the unwind data or the
+ * exports of a module.
+ */
+
+#ifndef SSEH_TEST_IMAGE_HPP
+#define SSEH_TEST_IMAGE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+//--------------------------------------------------------------------------------------------------
+
+class synthetic_image
+{
+    std::uint8_t* image = nullptr;
+    std::uint8_t* stubs = nullptr;
+    std::size_t functions = 0;
+    std::size_t detours = 0;
+
+public:
+
+    /// Each synthetic function is "mov eax, imm32; ret", padded to 16 bytes
+    static constexpr std::size_t function_size = 16;
+
+    /// Each detour is "lock inc qword [counter]; jmp qword [original]" followed by its data
+    static constexpr std::size_t stub_size = 32;
+
+    synthetic_image () = default;
+    synthetic_image (synthetic_image const&) = delete;
+    synthetic_image& operator = (synthetic_image const&) = delete;
+
+    ~synthetic_image ()
+    {
+        if (image) ::VirtualFree (image, 0, MEM_RELEASE);
+        if (stubs) ::VirtualFree (stubs, 0, MEM_RELEASE);
+    }
+
+    bool make (std::size_t function_count, std::size_t stub_count)
+    {
+        functions = function_count;
+        detours = stub_count;
+        image = (std::uint8_t*) ::VirtualAlloc (nullptr, functions * function_size + 1,
+                MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+        stubs = (std::uint8_t*) ::VirtualAlloc (nullptr, detours * stub_size + 1,
+                MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+        if (!image || !stubs)
+            return false;
+
+        for (std::size_t f = 0; f < functions; ++f)
+        {
+            auto p = function (f);
+            auto v = std::uint32_t (f);
+            std::memset (p, 0xCC, function_size);
+            p[0] = 0xB8;
+            std::memcpy (p + 1, &v, 4);
+            p[5] = 0xC3;
+        }
+
+        for (std::size_t s = 0; s < detours; ++s)
+        {
+            static const std::uint8_t code[] = {
+                0xF0, 0x48, 0xFF, 0x05, 0x08, 0x00, 0x00, 0x00, // lock inc qword [rip+8]
+                0xFF, 0x25, 0x0A, 0x00, 0x00, 0x00,             // jmp qword [rip+10]
+                0xCC, 0xCC
+            };
+            std::memcpy (stub (s), code, sizeof (code));
+            counter (s) = 0;
+            original (s) = nullptr;
+        }
+
+        ::FlushInstructionCache (::GetCurrentProcess (), image, functions * function_size);
+        ::FlushInstructionCache (::GetCurrentProcess (), stubs, detours * stub_size);
+        return true;
+    }
+
+    std::uint8_t* function (std::size_t f) { return image + f * function_size; }
+    std::uint8_t* stub (std::size_t s) { return stubs + s * stub_size; }
+
+    std::uint64_t& counter (std::size_t s) {
+        return *reinterpret_cast<std::uint64_t*> (stub (s) + 16);
+    }
+
+    void*& original (std::size_t s) {
+        return *reinterpret_cast<void**> (stub (s) + 24);
+    }
+
+    /// Runs a function through whatever detours it has, true if the original was reached
+    bool call (std::size_t f) {
+        return reinterpret_cast<std::uint32_t (*) ()> (function (f)) () == std::uint32_t (f);
+    }
+};
+
+//--------------------------------------------------------------------------------------------------
+
+/// A DLL written to the temporary folder and loaded, so that its functions are known from .pdata
+class synthetic_module
+{
+    HMODULE module = nullptr;
+    std::wstring path;
+
+    /// Layout of the only section: the code, the function table, their unwind data, the exports
+    static constexpr std::uint32_t headers_size = 0x400;
+    static constexpr std::uint32_t section_rva = 0x1000;
+    static constexpr std::uint32_t section_size = 0x400;
+    static constexpr std::uint32_t table_offset = 0x100;
+    static constexpr std::uint32_t unwind_offset = 0x180;
+    static constexpr std::uint32_t exports_offset = 0x200;
+
+public:
+
+    /// Offsets of a function in the code, [begin, end), and its unwind info if not a leaf one
+    struct range { std::uint32_t begin, end; std::vector<std::uint8_t> unwind; };
+
+    /// A name exported at an offset in the code, in the sorted order of the names
+    struct exported { const char* name; std::uint32_t offset; };
+
+    synthetic_module () = default;
+    synthetic_module (synthetic_module const&) = delete;
+    synthetic_module& operator = (synthetic_module const&) = delete;
+
+    ~synthetic_module ()
+    {
+        if (module) ::FreeLibrary (module);
+        if (!path.empty ()) ::DeleteFileW (path.c_str ());
+    }
+
+    bool make (const std::uint8_t* code, std::size_t code_size,
+               std::initializer_list<range> functions, std::initializer_list<exported> exports = {})
+    {
+        if (code_size > table_offset
+                || functions.size () * sizeof (RUNTIME_FUNCTION) > unwind_offset - table_offset)
+            return false;
+
+        std::vector<std::uint8_t> file (headers_size + section_size, 0);
+        auto dos = reinterpret_cast<IMAGE_DOS_HEADER*> (file.data ());
+        dos->e_magic = IMAGE_DOS_SIGNATURE;
+        dos->e_lfanew = sizeof (IMAGE_DOS_HEADER);
+
+        auto nt = reinterpret_cast<IMAGE_NT_HEADERS64*> (file.data () + dos->e_lfanew);
+        nt->Signature = IMAGE_NT_SIGNATURE;
+        nt->FileHeader.Machine = IMAGE_FILE_MACHINE_AMD64;
+        nt->FileHeader.NumberOfSections = 1;
+        nt->FileHeader.SizeOfOptionalHeader = sizeof (nt->OptionalHeader);
+        nt->FileHeader.Characteristics = IMAGE_FILE_EXECUTABLE_IMAGE
+            | IMAGE_FILE_LARGE_ADDRESS_AWARE | IMAGE_FILE_DLL;
+
+        auto& opt = nt->OptionalHeader;
+        opt.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+        opt.SizeOfCode = section_size;
+        opt.BaseOfCode = section_rva;
+        opt.ImageBase = 0x180000000ull;
+        opt.SectionAlignment = 0x1000;
+        opt.FileAlignment = 0x200;
+        opt.MajorOperatingSystemVersion = 6;
+        opt.MajorSubsystemVersion = 6;
+        opt.SizeOfImage = section_rva + 0x1000;
+        opt.SizeOfHeaders = headers_size;
+        opt.Subsystem = IMAGE_SUBSYSTEM_WINDOWS_GUI;
+        opt.DllCharacteristics = IMAGE_DLLCHARACTERISTICS_NX_COMPAT;
+        opt.SizeOfStackReserve = 0x100000;
+        opt.SizeOfStackCommit = 0x1000;
+        opt.SizeOfHeapReserve = 0x100000;
+        opt.SizeOfHeapCommit = 0x1000;
+        opt.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+        auto& pdata = opt.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+        pdata.VirtualAddress = section_rva + table_offset;
+        pdata.Size = DWORD (functions.size () * sizeof (RUNTIME_FUNCTION));
+
+        auto sec = IMAGE_FIRST_SECTION (nt);
+        std::memcpy (sec->Name, ".text", 5);
+        sec->Misc.VirtualSize = section_size;
+        sec->VirtualAddress = section_rva;
+        sec->SizeOfRawData = section_size;
+        sec->PointerToRawData = headers_size;
+        sec->Characteristics = IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ;
+
+        // No prolog, no unwind codes, shared by all leaf functions. The others follow, aligned.
+        auto raw = file.data () + headers_size;
+        std::memset (raw, 0xCC, table_offset);
+        std::memcpy (raw, code, code_size);
+        raw[unwind_offset] = 1;
+        auto table = reinterpret_cast<RUNTIME_FUNCTION*> (raw + table_offset);
+        std::uint32_t unwind = unwind_offset + 4;
+        for (auto const& f: functions)
+        {
+            table->BeginAddress = section_rva + f.begin;
+            table->EndAddress = section_rva + f.end;
+            table->UnwindData = section_rva + unwind_offset;
+            if (!f.unwind.empty ())
+            {
+                if (unwind + f.unwind.size () > exports_offset)
+                    return false;
+                std::memcpy (raw + unwind, f.unwind.data (), f.unwind.size ());
+                table->UnwindData = section_rva + unwind;
+                unwind += (std::uint32_t (f.unwind.size ()) + 3) & ~3u;
+            }
+            ++table;
+        }
+
+        if (!write_exports (raw, exports))
+            return false;
+        if (exports.size ())
+        {
+            auto& dir = opt.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+            dir.VirtualAddress = section_rva + exports_offset;
+            dir.Size = section_size - exports_offset;
+        }
+
+        wchar_t dir[MAX_PATH];
+        auto n = ::GetTempPathW (MAX_PATH, dir);
+        if (!n || n >= MAX_PATH)
+            return false;
+        path = std::wstring (dir, n) + name ();
+
+        auto h = ::CreateFileW (path.c_str (), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h == INVALID_HANDLE_VALUE)
+        {
+            path.clear ();
+            return false;
+        }
+        DWORD written = 0;
+        bool ok = ::WriteFile (h, file.data (), DWORD (file.size ()), &written, nullptr)
+            && written == file.size ();
+        ::CloseHandle (h);
+        module = ok ? ::LoadLibraryW (path.c_str ()) : nullptr;
+        return module != nullptr;
+    }
+
+    std::uint8_t* at (std::uint32_t offset) {
+        return reinterpret_cast<std::uint8_t*> (module) + section_rva + offset;
+    }
+
+    /// Of the file, the same for all modules made by this process
+    static std::wstring name () {
+        return L"sseh-test-" + std::to_wstring (::GetCurrentProcessId ()) + L".dll";
+    }
+
+    /// Unloads the module, leaving its file in place
+    void unload ()
+    {
+        if (module) ::FreeLibrary (module);
+        module = nullptr;
+    }
+
+private:
+
+    /// The directory, the addresses, the names, their ordinals, then the strings
+    static bool write_exports (std::uint8_t* raw, std::initializer_list<exported> exports)
+    {
+        if (!exports.size ())
+            return true;
+        auto n = DWORD (exports.size ());
+        auto dir = reinterpret_cast<IMAGE_EXPORT_DIRECTORY*> (raw + exports_offset);
+        auto functions = exports_offset + std::uint32_t (sizeof (*dir));
+        auto names = functions + n * std::uint32_t (sizeof (DWORD));
+        auto ordinals = names + n * std::uint32_t (sizeof (DWORD));
+        auto strings = ordinals + n * std::uint32_t (sizeof (WORD));
+        dir->Base = 1;
+        dir->NumberOfFunctions = n;
+        dir->NumberOfNames = n;
+        dir->AddressOfFunctions = section_rva + functions;
+        dir->AddressOfNames = section_rva + names;
+        dir->AddressOfNameOrdinals = section_rva + ordinals;
+
+        auto put = [raw, &strings] (std::string const& s) {
+            if (strings + s.size () + 1 > section_size)
+                return DWORD (0);
+            std::memcpy (raw + strings, s.c_str (), s.size () + 1);
+            auto rva = DWORD (section_rva + strings);
+            strings += std::uint32_t (s.size () + 1);
+            return rva;
+        };
+        std::string file;
+        for (auto c: name ())
+            file += char (c);
+        if (!(dir->Name = put (file)))
+            return false;
+        WORD i = 0;
+        for (auto const& e: exports)
+        {
+            reinterpret_cast<DWORD*> (raw + functions)[i] = section_rva + e.offset;
+            reinterpret_cast<WORD*> (raw + ordinals)[i] = i;
+            if (!(reinterpret_cast<DWORD*> (raw + names)[i] = put (e.name)))
+                return false;
+            ++i;
+        }
+        return true;
+    }
+};
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_TEST_IMAGE_HPP
@@ -0,0 +1,426 @@
+/**
+ * @file test_replay.cpp
+ * @brief Re-issues a recorded sequence of SSEH interface calls against synthetic targets
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Public API
+ *
+ * @details
+ * The input is what SSEH writes when started with SSEH_RECORD=1 in the environment. Every name
+ * which was successfully detoured, enabled, disabled, mapped or looked up during the recording is
+ * mapped to a synthetic function first. Then the calls are made in the same order, with detours
+ * replaced by counting stubs. Names bound to a module ("Name@module") are renamed to "Name!module"
+ * so that no real code gets patched. At the end, the recorded and replayed times are reported per
+ * function, together with the calls which returned differently than in the recording. A lookup
+ * counts as such also when its targets pair with the recorded ones differently than before.
+ *
+ * Usage: test_replay [sse-hooks.record]
+ */
+
+#include <sse-hooks/sse-hooks.h>
+#include <nlohmann/json.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+
+#include <windows.h>
+
+#include "test_image.hpp"
+
+//--------------------------------------------------------------------------------------------------
+
+using nlohmann::json;
+
+static synthetic_image image;
+
+/// Registry name to synthetic function index
+static std::map<std::string, std::size_t> names;
+
+/// Recorded detour and registry name to stub index
+static std::map<std::pair<std::string, std::string>, std::size_t> stubs;
+
+/// Recorded address to synthetic function index, as learned from "map_name"
+static std::map<std::string, std::size_t> addresses;
+
+/// Recorded target to the replayed one and back, as first found
+static std::map<std::string, std::uintptr_t> found;
+static std::map<std::uintptr_t, std::string> recorded_as;
+
+//--------------------------------------------------------------------------------------------------
+
+static std::string
+synthetic_name (json const& name)
+{
+    if (!name.is_string ())
+        return "";
+    auto s = name.get<std::string> ();
+    std::replace (s.begin (), s.end (), '@', '!');
+    return s;
+}
+
+static std::uintptr_t
+function_address (std::string const& name)
+{
+    auto it = names.find (name);
+    return it == names.end () ? 0 : std::uintptr_t (image.function (it->second));
+}
+
+static std::string
+bytes (json const& hex)
+{
+    std::string s, h = hex.is_string () ? hex.get<std::string> () : "";
+    for (std::size_t i = 0; i + 1 < h.size (); i += 2)
+        s.push_back (char (std::stoi (h.substr (i, 2), nullptr, 16)));
+    return s;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Assigns synthetic functions and stubs to what the recording used
+
+static void
+collect (std::vector<json> const& calls)
+{
+    for (auto const& c: calls)
+    {
+        auto const& f = c["f"];
+        auto const& a = c["a"];
+        if (a.empty () || !c["r"].get<int> ())
+            continue;
+        bool detour = f == "detour" || f == "detour_priority";
+        if (detour || f == "enable" || f == "disable" || f == "find_target" || f == "map_name")
+        {
+            names.emplace (synthetic_name (a[0]), names.size ());
+        }
+        if (detour)
+            stubs.emplace (std::make_pair (a[1].get<std::string> (), synthetic_name (a[0])),
+                           stubs.size ());
+        if (f == "find_targets")
+            for (auto const& name: a[0])
+                names.emplace (synthetic_name (name), names.size ());
+        if (f == "map_name")
+            addresses.emplace (a[1].get<std::string> (), names[synthetic_name (a[0])]);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Output buffers are sized as they were during the recording
+
+struct buffer
+{
+    std::size_t size;
+    std::vector<char> data;
+    buffer (json const& arg)
+        : size (arg.is_number () ? arg.get<std::size_t> () : 0)
+        , data (arg.is_number () ? std::max<std::size_t> (size, 1) : 0) {}
+    char* get () { return data.empty () ? nullptr : data.data (); }
+};
+
+//--------------------------------------------------------------------------------------------------
+
+/// Whether a found target pairs with its recorded value as the ones found before, if recorded
+
+static bool
+same_target (json const& recorded, std::uintptr_t target)
+{
+    if (!recorded.is_string ())
+        return true;
+    auto const& r = recorded.get_ref<std::string const&> ();
+    bool same = found.emplace (r, target).first->second == target;
+    return recorded_as.emplace (target, r).first->second == r && same;
+}
+
+/// The argument is made again as the command takes it, the opaque ones are not replayed
+
+static int
+execute (std::string const& command, json const& arg, int recorded)
+{
+    if (arg.is_null ())
+        return sseh_execute (command.c_str (), nullptr);
+    if (arg.is_string ())
+    {
+        // Not over the file written during the recording
+        auto path = arg.get<std::string> () + ".replay";
+        return sseh_execute (command.c_str (), &path[0]);
+    }
+    if (arg.contains ("size"))
+    {
+        sseh_memory m = {};
+        m.size = std::min (arg["size"].get<std::size_t> (), sizeof (m));
+        return sseh_execute (command.c_str (), &m);
+    }
+    if (arg.contains ("text"))
+    {
+        buffer b (arg["text"]);
+        sseh_text text = { b.size, b.get () };
+        return sseh_execute (command.c_str (), &text);
+    }
+    return recorded;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static int
+replay (json const& c)
+{
+    auto const& f = c["f"].get_ref<std::string const&> ();
+    auto const& a = c["a"];
+    auto arg = [&a] (std::size_t i) { return i < a.size () ? a[i] : json (); };
+    auto str = [&arg] (std::size_t i) {
+        auto v = arg (i);
+        return v.is_string () ? v.get<std::string> () : std::string ();
+    };
+
+    if (f == "version")
+    {
+        int api, maj, imp;
+        const char* build;
+        sseh_version (&api, &maj, &imp, &build);
+        return 0;
+    }
+    if (f == "last_error")
+    {
+        buffer b (arg (0));
+        sseh_last_error (&b.size, b.get ());
+        return 0;
+    }
+    if (f == "init")
+        return sseh_init ();
+    if (f == "uninit")
+        return 0; // The synthetic image still needs the hooks for the final check
+    if (f == "profile")
+        return sseh_profile (str (0).c_str ());
+    if (f == "find_address")
+    {
+        void* address = nullptr;
+        return sseh_find_address (str (0).c_str (), str (1).c_str (), &address);
+    }
+    if (f == "load")
+        return sseh_load (str (0).c_str ());
+    if (f == "map_name")
+    {
+        auto name = synthetic_name (arg (0));
+        return sseh_map_name (name.c_str (), function_address (name));
+    }
+    if (f == "find_target")
+    {
+        std::uintptr_t target;
+        return sseh_find_target (synthetic_name (arg (0)).c_str (), &target)
+            && same_target (c.value ("o", json ()), target);
+    }
+    if (f == "find_name")
+    {
+        auto it = addresses.find (str (0));
+        auto target = it == addresses.end () ? 0 : std::uintptr_t (image.function (it->second));
+        buffer b (arg (1));
+        return sseh_find_name (target, &b.size, b.get ());
+    }
+    if (f == "detour")
+    {
+        auto name = synthetic_name (arg (0));
+        auto it = stubs.find (std::make_pair (str (1), name));
+        if (it == stubs.end ())
+            return sseh_detour (name.c_str (), nullptr, nullptr);
+        return sseh_detour (name.c_str (), image.stub (it->second), &image.original (it->second));
+    }
+    if (f == "detour_priority")
+    {
+        auto name = synthetic_name (arg (0));
+        auto priority = arg (2).get<int> ();
+        auto it = stubs.find (std::make_pair (str (1), name));
+        if (it == stubs.end ())
+            return sseh_detour_priority (name.c_str (), nullptr, nullptr, priority);
+        return sseh_detour_priority (name.c_str (), image.stub (it->second),
+                                     &image.original (it->second), priority);
+    }
+    if (f == "enable")
+        return sseh_enable (synthetic_name (arg (0)).c_str ());
+    if (f == "disable")
+        return sseh_disable (synthetic_name (arg (0)).c_str ());
+    if (f == "enable_all")
+        return sseh_enable_all ();
+    if (f == "disable_all")
+        return sseh_disable_all ();
+    if (f == "apply")
+        return sseh_apply ();
+    if (f == "identify")
+    {
+        buffer b (arg (1));
+        return sseh_identify (str (0).c_str (), &b.size, b.get ());
+    }
+    if (f == "merge_patch")
+        return sseh_merge_patch (str (0).c_str ());
+    if (f == "execute")
+        return execute (str (0), arg (1), c["r"].get<int> ());
+    if (f == "identify_as")
+    {
+        buffer b (arg (2));
+        return sseh_identify_as (str (0).c_str (), arg (1).get<int> (), &b.size, b.get ());
+    }
+    if (f == "merge_patch_as")
+    {
+        auto data = bytes (arg (1));
+        return sseh_merge_patch_as (arg (0).get<int> (), data.data (), data.size ());
+    }
+    if (f == "changes_since")
+    {
+        std::uint64_t current;
+        buffer b (arg (1));
+        return sseh_changes_since (arg (0).get<std::uint64_t> (), &current, &b.size, b.get ());
+    }
+    if (f == "find_callers")
+    {
+        buffer b (arg (2));
+        std::vector<std::uintptr_t> callers (b.size);
+        return sseh_find_callers (synthetic_name (arg (0)).c_str (), arg (1).get<int> (),
+                                  &b.size, b.get () ? callers.data () : nullptr);
+    }
+    if (f == "find_targets")
+    {
+        std::vector<std::string> list;
+        for (auto const& name: arg (0))
+            list.push_back (synthetic_name (name));
+        std::vector<const char*> pointers;
+        for (auto const& name: list)
+            pointers.push_back (name.c_str ());
+        std::vector<std::uintptr_t> targets (pointers.size ());
+        int r = sseh_find_targets (pointers.data (), pointers.size (), targets.data ());
+        // A target found as another one than before shows as a mismatch
+        auto o = c.value ("o", json ());
+        for (std::size_t i = 0; i < o.size () && i < targets.size (); ++i)
+            if (targets[i] && !same_target (o[i], targets[i]))
+                return !c["r"].get<int> ();
+        return r;
+    }
+    if (f == "find_targets_by_id")
+    {
+        auto ids = arg (0).get<std::vector<std::uint64_t>> ();
+        std::vector<std::uintptr_t> targets (ids.size ());
+        return sseh_find_targets_by_id (ids.data (), ids.size (), targets.data ());
+    }
+
+    throw std::runtime_error ("unknown function " + f);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+int main (int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "sse-hooks.record";
+    std::ifstream fi (path);
+    if (!fi.is_open ())
+    {
+        std::cout << "Unable to open " << path << std::endl;
+        return 1;
+    }
+
+    std::vector<json> calls;
+    try
+    {
+        for (std::string line; std::getline (fi, line); )
+            if (!line.empty ())
+                calls.push_back (json::parse (line));
+    }
+    catch (std::exception const& ex)
+    {
+        std::cout << "Line " << (calls.size () + 1) << ": " << ex.what () << std::endl;
+        return 1;
+    }
+
+    collect (calls);
+    if (!image.make (names.size (), stubs.size ()))
+    {
+        std::cout << "Unable to prepare the synthetic image" << std::endl;
+        return 1;
+    }
+
+    // What SSEH does before the clients get the interface
+    if (!sseh_init ())
+        return 1;
+    for (auto const& n: names)
+        sseh_map_name (n.first.c_str (), std::uintptr_t (image.function (n.second)));
+
+    struct stats {
+        std::size_t calls = 0, mismatches = 0;
+        std::chrono::nanoseconds recorded {}, replayed {};
+    };
+    std::map<std::string, stats> functions;
+    stats total;
+
+    using std::chrono::steady_clock;
+    for (auto const& c: calls)
+    {
+        int r;
+        auto t = steady_clock::now ();
+        try
+        {
+            r = replay (c);
+        }
+        catch (std::exception const& ex)
+        {
+            std::cout << c.dump () << ": " << ex.what () << std::endl;
+            return 1;
+        }
+        auto d = steady_clock::now () - t;
+
+        for (auto s: { &functions[c["f"].get<std::string> ()], &total })
+        {
+            s->calls++;
+            s->mismatches += (r != 0) != (c["r"].get<int> () != 0);
+            s->recorded += std::chrono::nanoseconds (c["d"].get<std::int64_t> ());
+            s->replayed += d;
+        }
+    }
+
+    std::size_t broken = 0;
+    for (std::size_t f = 0; f < names.size (); ++f)
+        if (!image.call (f))
+            ++broken;
+
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    auto print = [] (std::string const& name, stats const& s)
+    {
+        std::cout << std::setw (16) << std::left << name
+                  << std::setw (8) << std::right << s.calls
+                  << std::setw (12) << duration_cast<microseconds> (s.recorded).count ()
+                  << std::setw (12) << duration_cast<microseconds> (s.replayed).count ()
+                  << std::setw (12) << s.mismatches << std::endl;
+    };
+    std::cout << std::setw (16) << std::left << "function" << std::right
+              << std::setw (8) << "calls" << std::setw (12) << "recorded us"
+              << std::setw (12) << "replayed us" << std::setw (12) << "mismatches" << std::endl;
+    for (auto const& f: functions)
+        print (f.first, f.second);
+    print ("total", total);
+    std::cout << names.size () << " targets, " << stubs.size () << " detours, "
+              << broken << " broken chains" << std::endl;
+
+    return broken ? 1 : 0;
+}
+
+//--------------------------------------------------------------------------------------------------
@@ -0,0 +1,379 @@
+/**
+ * @file test_skse.cpp
+ * @brief Simulates SKSE hosting SSEH together with a number of client plugins
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Public API
+ *
+ * @details
+ * Fakes the SKSE interfaces, a Data\SKSE\Plugins tree in the working folder and a game image made
+ * of synthetic functions. Then drives the SSEH plugin through the same sequence as SKSE does:
+ * query, load, post load (where clients register to SSEH) and post-post load (where SSEH hands its
+ * interface to the clients and applies). Each of the N clients uses its own profile to detour the
+ * same M functions, so that the hooks form chains. At the end, SSEH is uninitialized and all the
+ * functions must be back to their original code. Timings of each phase are reported. The startup is
+ * traced too, its trace must have a matching end for each begin event.
+ *
+ * Usage: test_skse [clients] [functions]
+ */
+
+#include <sse-hooks/sse-hooks.h>
+#include <nlohmann/json.hpp>
+#include <utils/winutils.hpp>
+
+#include <cstdint>
+typedef std::uint32_t UInt32;
+typedef std::uint64_t UInt64;
+#include <skse/PluginAPI.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <windows.h>
+
+#include "test_image.hpp"
+
+//--------------------------------------------------------------------------------------------------
+
+extern "C" SSEH_API bool SSEH_CCONV SKSEPlugin_Query (SKSEInterface const*, PluginInfo*);
+extern "C" SSEH_API bool SSEH_CCONV SKSEPlugin_Load (SKSEInterface const*);
+
+//--------------------------------------------------------------------------------------------------
+
+/// Plugin handle is an index here. Zero is SKSE itself, one is SSEH, the rest are the clients.
+static std::vector<std::string> plugins = { "SKSE" };
+
+/// The handle of the plugin being queried or loaded
+static PluginHandle loading = 0;
+
+/// The handle of the plugin whose listener is being called
+static PluginHandle receiving = 0;
+
+struct listener
+{
+    PluginHandle handle;
+    std::string sender;
+    SKSEMessagingInterface::EventCallback callback;
+};
+
+static std::vector<listener> listeners;
+
+//--------------------------------------------------------------------------------------------------
+
+static bool
+register_listener (PluginHandle handle, const char* sender, SKSEMessagingInterface::EventCallback cb)
+{
+    if (!sender || !cb)
+        return false;
+    listeners.push_back (listener { handle, sender, cb });
+    return true;
+}
+
+static bool
+dispatch (PluginHandle sender, UInt32 type, void* data, UInt32 len, const char* receiver)
+{
+    if (sender >= plugins.size ())
+        return false;
+    SKSEMessagingInterface::Message m { plugins[sender].c_str (), type, len, data };
+    for (std::size_t i = 0; i < listeners.size (); ++i) // Listeners may register more listeners
+    {
+        auto l = listeners[i];
+        if (l.sender != plugins[sender] || (receiver && plugins[l.handle] != receiver))
+            continue;
+        receiving = l.handle;
+        l.callback (&m);
+    }
+    return true;
+}
+
+static SKSEMessagingInterface messaging = {
+    SKSEMessagingInterface::kInterfaceVersion, register_listener, dispatch, nullptr
+};
+
+static void*
+query_interface (UInt32 id)
+{
+    return id == kInterface_Messaging ? &messaging : nullptr;
+}
+
+static PluginHandle
+plugin_handle ()
+{
+    return loading;
+}
+
+static SKSEInterface skse = {
+    0x02000100, 0x01050610, 0, 0, query_interface, plugin_handle, nullptr
+};
+
+//--------------------------------------------------------------------------------------------------
+
+/// Stands in for the game image and the client plugins' code
+static synthetic_image image;
+
+static int clients = 8;
+static int functions = 64;
+
+/// Calls of each function after the startup
+static const int hot_rounds = 1000;
+
+static std::string
+function_name (int f)
+{
+    return "Synthetic" + std::to_string (f);
+}
+
+/// Stub of a client, one per client and function
+static std::size_t
+stub_index (int client, int f)
+{
+    return std::size_t (client * functions + f);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The registry names of the synthetic functions come from a patch, as a mod would ship them
+
+static bool
+make_data_tree ()
+{
+    ::CreateDirectoryA ("Data", nullptr);
+    ::CreateDirectoryA ("Data\\SKSE", nullptr);
+    ::CreateDirectoryA ("Data\\SKSE\\Plugins", nullptr);
+    ::CreateDirectoryA ("Data\\SKSE\\Plugins\\sse-hooks", nullptr);
+
+    std::ofstream fo ("Data\\SKSE\\Plugins\\sse-hooks\\test-skse.json");
+    if (!fo.is_open ())
+        return false;
+
+    fo << "[{ \"op\": \"add\", \"path\": \"/map\", \"value\": {";
+    for (int f = 0; f < functions; ++f)
+        fo << (f ? "," : "") << "\n\"" << function_name (f) << "\": { \"target\": \"0x"
+           << std::hex << std::uintptr_t (image.function (f)) << std::dec << "\" }";
+    fo << "}}]";
+    return fo.good ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static sseh_api sseh;
+static bool client_failed = false;
+
+/// A client which got the SSEH interface detours all the synthetic functions in its own profile
+
+static void
+handle_sseh_message (SKSEMessagingInterface::Message* m)
+{
+    if (m->type != SSEH_API_VERSION || !m->dataLen)
+        return;
+
+    sseh = *reinterpret_cast<sseh_api*> (m->data);
+    int c = int (receiving) - 2;
+    if (!sseh.profile (plugins[receiving].c_str ()))
+    {
+        client_failed = true;
+        return;
+    }
+    for (int f = 0; f < functions; ++f)
+        if (!sseh.detour (function_name (f).c_str (), image.stub (stub_index (c, f)),
+                    &image.original (stub_index (c, f))))
+            client_failed = true;
+    if (!sseh.apply ())
+        client_failed = true;
+}
+
+static void
+handle_skse_message (SKSEMessagingInterface::Message* m)
+{
+    if (m->type == SKSEMessagingInterface::kMessage_PostLoad)
+        messaging.RegisterListener (receiving, "SSEH", handle_sseh_message);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static std::string
+last_error ()
+{
+    size_t n = 0;
+    sseh_last_error (&n, nullptr);
+    if (n)
+    {
+        std::string s (n+1, '\0');
+        sseh_last_error (&n, &s[0]);
+        return s.c_str ();
+    }
+    return "";
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The startup trace of the plugin, each begin event is ended in the reverse order on its thread
+
+static bool
+check_trace ()
+{
+    std::string path;
+    if (!known_folder_path (FOLDERID_Documents, path))
+        return false;
+    std::ifstream fi (path + "\\My Games\\Skyrim Special Edition\\SKSE\\sse-hooks.trace.json");
+    auto j = nlohmann::json::parse (fi, nullptr, false);
+    if (!j.is_object () || !j["traceEvents"].is_array ())
+        return false;
+
+    std::map<std::uint64_t, std::vector<nlohmann::json>> open;
+    std::set<std::string> names;
+    for (auto const& e: j["traceEvents"])
+    {
+        auto& scopes = open[e.value ("tid", std::uint64_t (0))];
+        auto ph = e.value ("ph", "");
+        if (ph == "B")
+        {
+            names.insert (e.value ("name", ""));
+            scopes.push_back (e);
+        }
+        else if (ph == "E" && !scopes.empty () && scopes.back ()["name"] == e["name"]
+                && scopes.back ()["ts"] <= e["ts"])
+            scopes.pop_back ();
+        else
+            return false;
+    }
+    for (auto const& t: open)
+        if (!t.second.empty ())
+            return false;
+
+    for (auto name: { "SKSEPlugin_Load", "open log", "merge patches", "dispatch interface", "apply" })
+        if (!names.count (name))
+            return false;
+    return std::any_of (names.begin (), names.end (), [] (std::string const& name) {
+        return name.compare (0, 7, "client ") == 0;
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+int main (int argc, char** argv)
+{
+    if (argc > 1) clients = std::max (1, std::atoi (argv[1]));
+    if (argc > 2) functions = std::max (1, std::atoi (argv[2]));
+
+    if (!image.make (functions, clients * functions) || !make_data_tree ())
+    {
+        std::cout << "Unable to prepare the synthetic image or data tree" << std::endl;
+        return 1;
+    }
+
+    using std::chrono::steady_clock;
+    std::vector<std::pair<const char*, steady_clock::duration>> phases;
+    auto t = steady_clock::now ();
+    auto phase = [&] (const char* name)
+    {
+        auto now = steady_clock::now ();
+        phases.emplace_back (name, now - t);
+        t = now;
+    };
+
+    bool result = true;
+
+    plugins.push_back ("");
+    loading = 1;
+    PluginInfo info = {};
+    result = result && SKSEPlugin_Query (&skse, &info);
+    plugins[1] = info.name ? info.name : "";
+    phase ("query");
+
+    _putenv ("SSEH_TRACE=1");
+    result = result && SKSEPlugin_Load (&skse);
+    for (int c = 0; c < clients; ++c)
+    {
+        plugins.push_back ("Client" + std::to_string (c));
+        messaging.RegisterListener (PluginHandle (plugins.size () - 1), "SKSE", handle_skse_message);
+    }
+    loading = kPluginHandle_Invalid;
+    phase ("load");
+
+    messaging.Dispatch (0, SKSEMessagingInterface::kMessage_PostLoad, nullptr, 0, nullptr);
+    phase ("post load");
+
+    messaging.Dispatch (0, SKSEMessagingInterface::kMessage_PostPostLoad, nullptr, 0, nullptr);
+    phase ("post-post load");
+
+    if (!result || client_failed)
+    {
+        std::cout << "Startup failed: " << last_error () << std::endl;
+        return 1;
+    }
+
+    // Each call runs through the whole chain of detours, down to the original function
+    for (int f = 0; f < functions; ++f)
+        if (!image.call (f))
+            result = false;
+    for (int c = 0; c < clients; ++c)
+        for (int f = 0; f < functions; ++f)
+            if (image.counter (stub_index (c, f)) != 1)
+                result = false;
+    phase ("first calls");
+
+    // Where the trampolines are placed shows in the repeated calls
+    for (int r = 0; r < hot_rounds; ++r)
+        for (int f = 0; f < functions; ++f)
+            image.call (f);
+    phase ("hot calls");
+
+    // Unhooked functions go straight to the original code
+    sseh_uninit ();
+    for (int f = 0; f < functions; ++f)
+        if (!image.call (f))
+            result = false;
+    for (int c = 0; c < clients; ++c)
+        for (int f = 0; f < functions; ++f)
+            if (image.counter (stub_index (c, f)) != 1 + hot_rounds)
+                result = false;
+    phase ("teardown");
+    bool traced = check_trace ();
+
+    std::cout << "clients " << clients << ", functions " << functions << std::endl;
+    for (auto const& p: phases)
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        std::cout << std::setw (16) << std::left << p.first
+                  << duration_cast<microseconds> (p.second).count () << "us" << std::endl;
+    }
+
+    std::remove ("Data\\SKSE\\Plugins\\sse-hooks\\test-skse.json");
+    if (!result)
+        std::cout << "Detour chains are broken" << std::endl;
+    if (!traced)
+        std::cout << "Startup trace is broken" << std::endl;
+    return result && traced ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------------------
@@ -0,0 +1,279 @@
+/**
+ * @file tracer.cpp
+ * @brief Implements the optional startup tracing
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * SKSE broadcasts the interface to all the listeners in one call, so the clients are told apart by
+ * the module which calls into the traced interface. The event of a client spans from its first
+ * call to the first call of the next client, hence it includes its own work between the calls,
+ * but not what it did before calling SSEH for the first time.
+ */
+
+#include "tracer.hpp"
+
+#include <utils/winutils.hpp>
+#include <nlohmann/json.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+
+#include <windows.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define caller_address() _ReturnAddress ()
+#else
+#define caller_address() __builtin_return_address (0)
+#endif
+
+//--------------------------------------------------------------------------------------------------
+
+std::atomic<bool> trace_enabled { false };
+
+struct trace_record
+{
+    std::string name, detail;
+    std::chrono::steady_clock::time_point start, end;
+    DWORD thread;
+};
+
+static std::vector<trace_record> trace_records;
+static std::mutex trace_mutex;
+static std::chrono::steady_clock::time_point trace_origin;
+
+/// The interface which does the actual work
+static sseh_api real = {};
+
+/// Client module which called last and since when
+static HMODULE client = nullptr;
+static std::chrono::steady_clock::time_point client_start;
+static std::size_t client_calls = 0;
+
+//--------------------------------------------------------------------------------------------------
+
+void
+trace_start ()
+{
+    std::lock_guard<std::mutex> lock (trace_mutex);
+    trace_records.clear ();
+    trace_records.reserve (256);
+    trace_origin = std::chrono::steady_clock::now ();
+    trace_enabled = true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+trace_event (const char* name, const char* detail,
+             std::chrono::steady_clock::time_point start,
+             std::chrono::steady_clock::time_point end)
+{
+    std::lock_guard<std::mutex> lock (trace_mutex);
+    if (trace_enabled)
+        trace_records.push_back ({ name, detail ? detail : "", start, end, ::GetCurrentThreadId () });
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static std::string
+module_name (HMODULE module)
+{
+    std::wstring path (MAX_PATH, L'\0');
+    path.resize (::GetModuleFileNameW (module, &path[0], DWORD (path.size ())));
+    std::string name;
+    if (!utf16_to_utf8 (path.c_str (), name))
+        return "?";
+    return name.substr (name.find_last_of ("\\/") + 1);
+}
+
+/// Ends the event of the last client, if the call came from another one
+
+static void
+client_call (void* address)
+{
+    if (!trace_enabled)
+        return;
+
+    HMODULE module = nullptr;
+    ::GetModuleHandleExW (GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS
+            | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCWSTR) address, &module);
+
+    std::lock_guard<std::mutex> lock (trace_mutex);
+    if (!trace_enabled)
+        return;
+    if (module == client && client_calls)
+    {
+        ++client_calls;
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now ();
+    if (client_calls)
+    {
+        trace_records.push_back ({ "client " + module_name (client),
+                std::to_string (client_calls) + " calls", client_start, now, ::GetCurrentThreadId () });
+    }
+    client = module;
+    client_start = now;
+    client_calls = 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+trace_clients_end ()
+{
+    auto now = std::chrono::steady_clock::now ();
+    std::lock_guard<std::mutex> lock (trace_mutex);
+    if (trace_enabled && client_calls)
+    {
+        trace_records.push_back ({ "client " + module_name (client),
+                std::to_string (client_calls) + " calls", client_start, now, ::GetCurrentThreadId () });
+    }
+    client = nullptr;
+    client_calls = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// One wrapper per interface member, noting the calling module before forwarding the call
+
+template<class Member, Member sseh_api::* member, class Function>
+struct traced;
+
+template<class Member, Member sseh_api::* member, class R, class... Args>
+struct traced<Member, member, R (SSEH_CCONV*) (Args...)>
+{
+    static R SSEH_CCONV call (Args... args)
+    {
+        client_call (caller_address ());
+        return (real.*member) (args...);
+    }
+};
+
+#define TRACED(m) traced<decltype (sseh_api::m), &sseh_api::m, decltype (sseh_api::m)>::call
+
+sseh_api
+trace_api (sseh_api const& api)
+{
+    real = api;
+    sseh_api tr         = api;
+	tr.version          = TRACED (version);
+	tr.last_error       = TRACED (last_error);
+	tr.init             = TRACED (init);
+	tr.uninit           = TRACED (uninit);
+	tr.profile          = TRACED (profile);
+	tr.find_address     = TRACED (find_address);
+	tr.load             = TRACED (load);
+	tr.map_name         = TRACED (map_name);
+	tr.find_target      = TRACED (find_target);
+	tr.find_name        = TRACED (find_name);
+	tr.detour           = TRACED (detour);
+	tr.enable           = TRACED (enable);
+	tr.disable          = TRACED (disable);
+	tr.enable_all       = TRACED (enable_all);
+	tr.disable_all      = TRACED (disable_all);
+	tr.apply            = TRACED (apply);
+	tr.identify         = TRACED (identify);
+	tr.merge_patch      = TRACED (merge_patch);
+	tr.execute          = TRACED (execute);
+	tr.identify_as      = TRACED (identify_as);
+	tr.merge_patch_as   = TRACED (merge_patch_as);
+	tr.changes_since    = TRACED (changes_since);
+	tr.detour_priority  = TRACED (detour_priority);
+	tr.find_callers     = TRACED (find_callers);
+	tr.find_targets     = TRACED (find_targets);
+	tr.find_targets_by_id = TRACED (find_targets_by_id);
+    return tr;
+}
+
+#undef TRACED
+
+//--------------------------------------------------------------------------------------------------
+
+bool
+trace_write (std::string const& path)
+{
+    trace_clients_end ();
+
+    std::lock_guard<std::mutex> lock (trace_mutex);
+    trace_enabled = false;
+
+    // Each record as a begin and an end event. By thread and time, a scope is ended once the next
+    // one is not within it. Of the same times, the outer scope is recorded later and begins first.
+    std::vector<trace_record const*> sorted;
+    sorted.reserve (trace_records.size ());
+    for (auto const& r: trace_records)
+        sorted.push_back (&r);
+    std::sort (sorted.begin (), sorted.end (), [] (trace_record const* a, trace_record const* b)
+    {
+        if (a->thread != b->thread)
+            return a->thread < b->thread;
+        if (a->start != b->start)
+            return a->start < b->start;
+        if (a->end != b->end)
+            return a->end > b->end;
+        return a > b;
+    });
+
+    using namespace std::chrono;
+    auto pid = ::GetCurrentProcessId ();
+    auto events = nlohmann::json::array ();
+    auto add = [&] (trace_record const& r, bool begin)
+    {
+        nlohmann::json e = {
+            { "name", r.name },
+            { "cat", "sseh" },
+            { "ph", begin ? "B" : "E" },
+            { "ts", duration_cast<nanoseconds> ((begin ? r.start : r.end) - trace_origin).count ()
+                / 1000.0 },
+            { "pid", pid },
+            { "tid", r.thread }
+        };
+        if (begin && !r.detail.empty ())
+            e["args"] = { { "detail", r.detail } };
+        events.push_back (std::move (e));
+    };
+
+    std::vector<trace_record const*> open;
+    for (auto r: sorted)
+    {
+        while (!open.empty () && (open.back ()->thread != r->thread || open.back ()->end < r->end))
+        {
+            add (*open.back (), false);
+            open.pop_back ();
+        }
+        add (*r, true);
+        open.push_back (r);
+    }
+    for (; !open.empty (); open.pop_back ())
+        add (*open.back (), false);
+    trace_records.clear ();
+
+    std::ofstream fo (path, std::ios::binary | std::ios::trunc);
+    fo << nlohmann::json { { "traceEvents", std::move (events) }, { "displayTimeUnit", "ms" } }.dump ();
+    return bool (fo);
+}
+
+//--------------------------------------------------------------------------------------------------
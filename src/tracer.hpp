@@ -0,0 +1,92 @@
+/**
+ * @file tracer.hpp
+ * @brief Optional tracing of where SSEH spends the game startup
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * Scopes are collected in memory and written at once as begin ("B") and end ("E") event pairs in the
+ * Chrome trace-event format, which chrome://tracing, Perfetto or Speedscope can open. When not
+ * started, a #trace_scope costs only the check of #trace_enabled.
+ */
+
+#ifndef SSEH_TRACER_HPP
+#define SSEH_TRACER_HPP
+
+#include <sse-hooks/sse-hooks.h>
+#include <string>
+#include <chrono>
+#include <atomic>
+
+//--------------------------------------------------------------------------------------------------
+
+/// Set by #trace_start(), until #trace_write(), the client threads check it while it is cleared
+extern std::atomic<bool> trace_enabled;
+
+/// Starts collecting the events
+void trace_start ();
+
+/// One complete event, optional detail is shown as its argument
+void trace_event (const char* name, const char* detail,
+                  std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end);
+
+/// Make the same interface, but with the time between the calls of each client module traced
+sseh_api trace_api (sseh_api const& api);
+
+/// Closes the event of the last client module which called through #trace_api()
+void trace_clients_end ();
+
+/// Writes all the collected events into the given file and stops, false if it can't be written
+bool trace_write (std::string const& path);
+
+//--------------------------------------------------------------------------------------------------
+
+/// Traces its own lifetime
+
+class trace_scope
+{
+    const char* name;
+    const char* detail;
+    std::chrono::steady_clock::time_point start;
+
+public:
+
+    explicit trace_scope (const char* name, const char* detail = nullptr)
+        : name (trace_enabled ? name : nullptr), detail (detail)
+    {
+        if (this->name)
+            start = std::chrono::steady_clock::now ();
+    }
+
+    ~trace_scope ()
+    {
+        if (name)
+            trace_event (name, detail, start, std::chrono::steady_clock::now ());
+    }
+
+    trace_scope (trace_scope const&) = delete;
+    trace_scope& operator = (trace_scope const&) = delete;
+};
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_TRACER_HPP
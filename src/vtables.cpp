@@ -0,0 +1,199 @@
+/**
+ * @file vtables.cpp
+ * @copybrief vtables.hpp
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * The read-only data is walked twice: first for the locators, which point back to themselves in
+ * x64 images and so are unlikely to be matched by chance, then for the pointers to them, which
+ * precede the tables.
+ */
+
+#include "vtables.hpp"
+#include "cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+//--------------------------------------------------------------------------------------------------
+
+/// RTTICompleteObjectLocator of the x64 images, all pointers are relative to the module base
+struct rtti_locator
+{
+    std::uint32_t signature, offset, cd_offset, type, hierarchy, self;
+};
+
+/// Offset of the decorated name in the type descriptor, after its vtable and spare pointers
+static constexpr std::uint32_t type_name_offset = 16;
+
+/// Longest decorated name considered, the game ones are well below
+static constexpr std::size_t max_type_name = 1024;
+
+static std::unordered_map<std::uintptr_t, vtable_index> indexes;
+
+//--------------------------------------------------------------------------------------------------
+
+std::uintptr_t
+vtable_index::find (std::uintptr_t base, std::string const& name) const
+{
+    auto it = std::lower_bound (tables.begin (), tables.end (), name,
+            [] (auto const& t, std::string const& n) { return t.first < n; });
+    return it != tables.end () && it->first == name ? base + it->second : 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// The undecorated name of a locator at the given address, empty if it does not look like one
+
+static std::string
+locator_class (module_info const& m, std::uintptr_t address)
+{
+    auto l = reinterpret_cast<const rtti_locator*> (address);
+    if (l->signature != 1 || l->offset != 0 || l->self != address - m.base
+            || l->type >= m.size - type_name_offset)
+        return {};
+
+    auto name = reinterpret_cast<const char*> (m.base + l->type + type_name_offset);
+    auto size = std::min<std::size_t> (max_type_name, m.size - l->type - type_name_offset);
+    auto end = static_cast<const char*> (std::memchr (name, 0, size));
+    return end ? undecorate_class (name, end - name) : std::string ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
+static void
+scan (module_info const& m, std::vector<std::pair<std::string, std::uint32_t>>& tables)
+{
+    std::unordered_map<std::uintptr_t, std::string> locators;
+    std::uintptr_t low = UINTPTR_MAX, high = 0;
+    for (auto const& s: m.sections)
+    {
+        if (!s.is_data ())
+            continue;
+        for (auto p = (s.begin + 3) & ~std::uintptr_t (3); p + sizeof (rtti_locator) <= s.end; p += 4)
+            if (auto name = locator_class (m, p); !name.empty ())
+            {
+                locators.emplace (p, std::move (name));
+                low = std::min (low, p);
+                high = std::max (high, p);
+            }
+    }
+
+    for (auto const& s: m.sections)
+    {
+        if (!s.is_data ())
+            continue;
+        for (auto p = (s.begin + 7) & ~std::uintptr_t (7); p + 16 <= s.end; p += 8)
+        {
+            auto v = *reinterpret_cast<const std::uintptr_t*> (p);
+            if (v < low || v > high)
+                continue;
+            if (auto it = locators.find (v); it != locators.end ())
+                tables.emplace_back (it->second, std::uint32_t (p + 8 - m.base));
+        }
+    }
+
+    // Only the first table is kept, if the same class has more than one of them
+    std::stable_sort (tables.begin (), tables.end (),
+            [] (auto const& a, auto const& b) { return a.first < b.first; });
+    tables.erase (std::unique (tables.begin (), tables.end (),
+            [] (auto const& a, auto const& b) { return a.first == b.first; }), tables.end ());
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Records of the RVA, the name size and the name itself
+
+static std::string
+serialize (std::vector<std::pair<std::string, std::uint32_t>> const& tables)
+{
+    std::string bytes;
+    for (auto const& t: tables)
+    {
+        std::uint32_t head[2] = { t.second, std::uint32_t (t.first.size ()) };
+        bytes.append (reinterpret_cast<const char*> (head), sizeof (head));
+        bytes.append (t.first);
+    }
+    return bytes;
+}
+
+static bool
+deserialize (std::string const& bytes, std::vector<std::pair<std::string, std::uint32_t>>& tables)
+{
+    for (std::size_t i = 0; i < bytes.size (); )
+    {
+        std::uint32_t head[2];
+        if (bytes.size () - i < sizeof (head))
+            return false;
+        std::memcpy (head, bytes.data () + i, sizeof (head));
+        i += sizeof (head);
+        if (bytes.size () - i < head[1])
+            return false;
+        tables.emplace_back (bytes.substr (i, head[1]), head[0]);
+        i += head[1];
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+vtable_index const&
+find_vtables (module_info const& m)
+{
+    if (!m.size)
+        throw std::runtime_error ("not a PE image");
+
+    auto hash = module_hash (m);
+    auto& x = indexes[m.base];
+    if (x.hash == hash)
+        return x;
+
+    x.hash = hash;
+    x.tables.clear ();
+
+    load_or_build (hash, "vtables",
+        [&x] (std::string const& bytes) {
+            if (deserialize (bytes, x.tables))
+                return true;
+            x.tables.clear ();
+            return false;
+        },
+        [&m, &x] {
+            scan (m, x.tables);
+            return true;
+        },
+        [&x] { return serialize (x.tables); });
+    return x;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+clear_vtables ()
+{
+    indexes.clear ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
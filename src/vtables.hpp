@@ -0,0 +1,90 @@
+/**
+ * @file vtables.hpp
+ * @brief Virtual tables of a module, found by their run-time type information
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * MSVC places a pointer to the complete object locator just before each virtual table, which in
+ * turn points to the type descriptor holding the decorated class name. Only the primary tables,
+ * at offset zero in the object, are kept, so that each class has one "Class::vtbl".
+ */
+
+#ifndef SSEH_VTABLES_HPP
+#define SSEH_VTABLES_HPP
+
+#include "modules.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+
+struct vtable_index
+{
+    std::uint64_t hash;                                         ///< Of the module headers
+    std::vector<std::pair<std::string, std::uint32_t>> tables;  ///< Class names and RVAs, by name
+
+    /// The address of the virtual table of the class, zero if unknown
+    std::uintptr_t find (std::uintptr_t base, std::string const& name) const;
+};
+
+/// Loads or scans the index of the module on first use
+vtable_index const& find_vtables (module_info const& m);
+
+/// "Outer::Inner" for ".?AVInner@Outer@@", empty for the templates and the other unusual names
+inline std::string
+undecorate_class (const char* name, std::size_t size)
+{
+    std::string_view s (name, size);
+    if (s.size () < 7 || (s.substr (0, 4) != ".?AV" && s.substr (0, 4) != ".?AU")
+            || s.substr (s.size () - 2) != "@@")
+        return {};
+    s = s.substr (4, s.size () - 6);
+    if (s.front () == '@' || s.find_first_of ("?$") != std::string_view::npos)
+        return {};
+
+    // Innermost first, as "Inner@Outer"
+    std::string r;
+    for (std::size_t end = s.size (); end != std::string_view::npos; )
+    {
+        auto at = s.rfind ('@', end - 1);
+        auto begin = at == std::string_view::npos ? 0 : at + 1;
+        if (begin == end)
+            return {};
+        if (!r.empty ())
+            r += "::";
+        r.append (s.substr (begin, end - begin));
+        end = at;
+    }
+    return r;
+}
+
+/// Drops the indexes in memory, the ones on disk stay
+void clear_vtables ();
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_VTABLES_HPP
+
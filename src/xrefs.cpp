@@ -0,0 +1,198 @@
+/**
+ * @file xrefs.cpp
+ * @copybrief xrefs.hpp
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * The sections are decoded linearly, as the instruction boundaries are not known otherwise. Each
+ * thread takes a slice and starts decoding a bit before it, by which point the x86 decoding has
+ * fallen back in step with the real boundaries, and keeps only the instructions starting inside.
+ * The code is read from the image file, as the memory may be patched already by SKSE, the other
+ * plugins or the detours. Only if the file can't be read, the memory is decoded instead and the
+ * index is not stored, so the references hidden by the patches are missing for this run only.
+ */
+
+#include "xrefs.hpp"
+#include "cache.hpp"
+
+#include <minhook/src/hde/hde64.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+//--------------------------------------------------------------------------------------------------
+
+/// Bytes decoded before each slice, to get in step with the instruction boundaries
+static constexpr std::uintptr_t slice_lead = 64;
+
+/// Longest x86 instruction, decoding never reads past it
+static constexpr std::uintptr_t max_instruction = 15;
+
+static std::unordered_map<std::uintptr_t, xref_index> indexes;
+
+//--------------------------------------------------------------------------------------------------
+
+void
+xref_index::find (std::uintptr_t base, std::uintptr_t target, unsigned kinds,
+                  std::vector<std::uintptr_t>& out) const
+{
+    if (target < base || target - base > 0xffffffffu)
+        return;
+    auto to = std::uint32_t (target - base);
+    auto first = std::lower_bound (refs.begin (), refs.end (), to, [] (xref const& x, std::uint32_t t) {
+        return x.to < t;
+    });
+    for (; first != refs.end () && first->to == to; ++first)
+        if (first->kind () & kinds)
+            out.push_back (base + first->source ());
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Code of a section to decode, from the image file or from memory, readable up to avail bytes
+
+struct code_view
+{
+    std::uint32_t rva;
+    const std::uint8_t* bytes;
+    std::size_t size, avail;
+};
+
+/// The references of the instructions starting in [begin, end) of the view, decoded from lead on
+
+static void
+decode (module_info const& m, code_view const& v, std::size_t lead, std::size_t begin,
+        std::size_t end, std::vector<xref>& out)
+{
+    if (v.avail < max_instruction)
+        return;
+    auto limit = std::min (end, v.avail - max_instruction);
+    auto keep = [&] (std::size_t ip, std::int64_t dest, unsigned kind) {
+        dest += v.rva;
+        if (ip >= begin && dest >= 0 && std::uint64_t (dest) < m.size)
+            out.push_back (xref { std::uint32_t (dest),
+                                  std::uint32_t (v.rva + ip) | (kind << 30) });
+    };
+
+    hde64s hs;
+    for (auto ip = lead; ip < limit; )
+    {
+        auto len = hde64_disasm (v.bytes + ip, &hs);
+        if (hs.flags & F_ERROR || !len)
+        {
+            ++ip;
+            continue;
+        }
+        std::int64_t next = ip + len;
+
+        if ((hs.opcode == 0xE8 || hs.opcode == 0xE9) && (hs.flags & F_IMM32))
+            keep (ip, next + std::int32_t (hs.imm.imm32), hs.opcode == 0xE8 ? 0 : 1);
+        else if ((hs.flags & F_MODRM) && hs.modrm_mod == 0 && hs.modrm_rm == 5)
+            keep (ip, next + std::int32_t (hs.disp.disp32), 2);
+
+        ip = next;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+
+/// Decodes all code sections of the image file, or of the memory if the file is empty, split
+/// among the hardware threads
+
+static void
+build (module_info const& m, std::string const& file, std::vector<xref>& refs)
+{
+    std::vector<code_view> views;
+    for (auto const& s: m.sections)
+    {
+        if (!(s.characteristics & IMAGE_SCN_MEM_EXECUTE))
+            continue;
+        code_view v;
+        v.rva = std::uint32_t (s.begin - m.base);
+        v.size = s.end - s.begin;
+        if (file.empty ())
+        {
+            v.bytes = reinterpret_cast<const std::uint8_t*> (s.begin);
+            v.avail = m.base + m.size - s.begin;
+        }
+        else
+        {
+            if (s.file_offset >= file.size ())
+                continue;
+            v.bytes = reinterpret_cast<const std::uint8_t*> (file.data ()) + s.file_offset;
+            v.avail = file.size () - s.file_offset;
+            v.size = std::min<std::size_t> (v.size, s.file_size);
+        }
+        views.push_back (v);
+    }
+
+    std::vector<std::size_t> sizes;
+    for (auto const& v: views)
+        sizes.push_back (v.size);
+
+    scan_slices (sizes,
+        [&m, &views] (std::size_t i, std::size_t begin, std::size_t end, std::vector<xref>& out) {
+            decode (m, views[i], begin - std::min (begin, slice_lead), begin, end, out);
+        },
+        [] (xref const& a, xref const& b) {
+            return a.to < b.to || (a.to == b.to && a.from < b.from);
+        }, refs);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+xref_index const&
+find_xrefs (module_info const& m)
+{
+    if (!m.size)
+        throw std::runtime_error ("not a PE image");
+
+    auto hash = module_hash (m);
+    auto& x = indexes[m.base];
+    if (x.hash == hash)
+        return x;
+
+    x.hash = hash;
+    x.refs.clear ();
+
+    load_or_build (hash, "xrefs", x.refs, [&m] (std::vector<xref>& refs) {
+        std::string file;
+        bool unpatched = read_image (m, file);
+        build (m, file, refs);
+        // The patches in memory may hide some references, not to be kept for the next runs
+        return unpatched;
+    });
+    return x;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void
+clear_xrefs ()
+{
+    indexes.clear ();
+}
+
+//--------------------------------------------------------------------------------------------------
+
@@ -0,0 +1,73 @@
+/**
+ * @file xrefs.hpp
+ * @brief Index of the code references in a module, looked up by their destinations
+ * @internal
+ *
+ * This file is part of SSE Hooks project (aka SSEH).
+ *
+ *   SSEH is free software: you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   SSEH is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with SSEH. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @endinternal
+ *
+ * @ingroup Core
+ *
+ * @details
+ * The code sections of a module are decoded once, in parallel, and each rel32 call, rel32 jump and
+ * RIP-relative operand landing inside the module is kept by its destination. The index is stored
+ * on disk under the hash of the module headers, so the next start of the same game build reads it
+ * back instead of decoding again.
+ */
+
+#ifndef SSEH_XREFS_HPP
+#define SSEH_XREFS_HPP
+
+#include "modules.hpp"
+
+#include <cstdint>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+
+/// Kinds of the references, same as SSEH_XREF_CALL, SSEH_XREF_JUMP and SSEH_XREF_DATA
+enum : unsigned { xref_call = 1, xref_jump = 2, xref_data = 4 };
+
+/// Relative to the module base, the kind is in the two top bits of the source
+struct xref
+{
+    std::uint32_t to, from;
+
+    std::uint32_t source () const { return from & 0x3fffffff; }
+    unsigned kind () const { return 1u << (from >> 30); }
+};
+
+struct xref_index
+{
+    std::uint64_t hash;         ///< Of the module headers, tells the game builds apart
+    std::vector<xref> refs;     ///< Ordered by destination, then by source
+
+    /// Appends the addresses of the instructions of the given kinds referencing the target
+    void find (std::uintptr_t base, std::uintptr_t target, unsigned kinds,
+               std::vector<std::uintptr_t>& out) const;
+};
+
+/// Loads or builds the index of the module on first use
+xref_index const& find_xrefs (module_info const& m);
+
+/// Drops the indexes in memory, the ones on disk stay
+void clear_xrefs ();
+
+//--------------------------------------------------------------------------------------------------
+
+#endif //SSEH_XREFS_HPP
+